@@ -0,0 +1,80 @@
+import numpy as np
+
+MAGIC = b'PATHFEAT'
+VERSION = 1
+
+HEADER = np.dtype([
+    ('magic', 'S8'),
+    ('version', '<u4'),
+    ('n_features', '<u4'),
+    ('n_rows', '<u8'),
+    ('n_units', '<u4'),
+    ('reserved', '<u4'),
+    ('names_offset', '<u8'),
+    ('unit_offset', '<u8'),
+    ('path_offset', '<u8'),
+    ('count_offset', '<u8'),
+    ('feature_offset', '<u8'),
+])
+
+
+class FeatureFile(object):
+    """
+    A binary feature file written by StaticEstimatorPass with
+    -static-estimation-format=binary. Nothing is read into memory up front:
+    the columns are memory maps, so chunks of any size can be sliced out.
+
+    X is n_rows x n_features (a transposed view of the feature columns),
+    counts the profiled count and paths the path number of each row.
+    """
+    def __init__(self, filename):
+        self.filename = filename
+        header = np.fromfile(filename, dtype=HEADER, count=1)
+        if len(header) != 1 or header['magic'][0] != MAGIC:
+            raise ValueError('{} is not a feature file'.format(filename))
+        header = header[0]
+        if header['version'] != VERSION:
+            raise ValueError('{} has version {}, expected {}'.format(
+                filename, header['version'], VERSION))
+
+        self.n_features = int(header['n_features'])
+        self.n_rows = int(header['n_rows'])
+        names = self._read_names(int(header['names_offset']),
+                                 self.n_features + int(header['n_units']))
+        self.feature_names = names[:self.n_features]
+        self.unit_names = names[self.n_features:]
+
+        self.units = self._column(header['unit_offset'], '<u4', (self.n_rows,))
+        self.paths = self._column(header['path_offset'], '<u8', (self.n_rows,))
+        self.counts = self._column(header['count_offset'], '<u4', (self.n_rows,))
+        self.features = self._column(header['feature_offset'], '<f4',
+                                     (self.n_features, self.n_rows))
+        self.X = self.features.T
+
+    def _read_names(self, offset, n):
+        names = []
+        with open(self.filename, 'rb') as f:
+            f.seek(offset)
+            for _ in range(n):
+                length = int(np.fromfile(f, dtype='<u4', count=1)[0])
+                names.append(f.read(length).decode('utf-8'))
+        return names
+
+    def _column(self, offset, dtype, shape):
+        # memmap cannot map zero bytes
+        if self.n_rows == 0:
+            return np.zeros(shape, dtype=dtype)
+        return np.memmap(self.filename, dtype=dtype, mode='r',
+                         offset=int(offset), shape=shape)
+
+    def ids(self, start=0, stop=None):
+        """IDs of rows [start, stop), as in the ID column of the CSV"""
+        stop = self.n_rows if stop is None else stop
+        return ['{}.{}'.format(self.unit_names[u], p)
+                for u, p in zip(self.units[start:stop], self.paths[start:stop])]
+
+    def chunks(self, chunksize):
+        """(counts, X) for consecutive chunks of at most chunksize rows"""
+        for start in range(0, self.n_rows, chunksize):
+            stop = min(start + chunksize, self.n_rows)
+            yield self.counts[start:stop], np.asarray(self.X[start:stop])
@@ -21,11 +21,12 @@ from lstm_utils import *
 
 MAX_EPOCH = 3
 MAX_BB = 70
+OPCODES = None
 
 
 def get_csv_list(folder):
-    '''Get a list of CSV files out of a folder with glob'''
-    return glob.glob(os.path.join(folder, '*.csv'))
+    '''Get a list of CSV files, and sparse .lstm files, out of a folder with glob'''
+    return glob.glob(os.path.join(folder, '*.csv')) + glob.glob(os.path.join(folder, '*.lstm'))
 
 def cv_on_filelist(files):
     '''Run cross validation at the file level
@@ -118,7 +119,7 @@ def combine_files(files):
     Xs = []
     ys = []
     for f in files:
-        X, y, _ = load_features(f, MAX_BB)
+        X, y, _ = load_features(f, MAX_BB, OPCODES)
         Xs.append(X)
         ys.append(y)
     allX = np.concatenate(Xs, axis=0)
@@ -129,7 +130,7 @@ def combine_files(files):
 def train_model(train_X, train_y, test_X, test_y, valid_X, valid_y, fold_no):
     print("Rebuilding model!")
     print("We have {} train examples and {} test examples".format(train_X.shape[0], test_X.shape[0]))
-    model = load_model()
+    model = load_model(train_X.shape[2])
     metric_vals = defaultdict(list)
 
     for E in range(MAX_EPOCH):
@@ -157,14 +158,16 @@ def train_model(train_X, train_y, test_X, test_y, valid_X, valid_y, fold_no):
     with open('saved_model_arch_{}.json'.format(fold_no), 'w') as f:
         f.write(json_string)
     model.save_weights('saved_model_weights_{}.h5'.format(fold_no), overwrite=True)
+    with open('saved_model_opcodes_{}.json'.format(fold_no), 'w') as f:
+        json.dump(OPCODES, f)
         
     return metric_vals
 
 
-def load_model():
+def load_model(n_features):
     model = Sequential()
     #model.add(Masking(-1, ))
-    model.add(LSTM(256, input_shape=(MAX_BB, 100), return_sequences=True))
+    model.add(LSTM(256, input_shape=(MAX_BB, n_features), return_sequences=True))
     model.add(LSTM(256, return_sequences=True))
     model.add(TimeDistributedDense(2))
     model.add(Activation('softmax'))
@@ -177,15 +180,24 @@ def load_model():
 def get_max_BB_len(files):
     max_bb = 0
     for filename in files:
+        if is_sparse(filename):
+            _, paths, _ = read_sparse(filename)
+            file_bb = max([n_bb for _, _, _, n_bb in paths] + [0])
+            max_bb = max(max_bb, file_bb)
+            print(filename, " longest path is ", file_bb)
+            continue
         with open(filename) as f:
             file_bb = 0;
             while True:
                 line = next(f, None)
                 if not line:
                     break
+                if line.startswith('#'):
+                    continue
 
                 try:
-                    fn, ID, truth, n_bb = line.strip('\n').split(' ')
+                    # Indexed paths list their blocks in a fifth field
+                    fn, ID, truth, n_bb = line.strip('\n').split(' ')[:4]
                     n_bb = int(n_bb)
                 except ValueError:
                     pass
@@ -197,13 +209,14 @@ def get_max_BB_len(files):
 
 
 def main():
-    global MAX_BB
+    global MAX_BB, OPCODES
     folder = "../scripts/feature_files_lstm_" + sys.argv[1]
     if (not os.path.exists(folder)):
         print(folder + " does not exist. Exiting...")
         exit()
     files = get_csv_list(folder)
     MAX_BB = get_max_BB_len(files)
+    OPCODES = get_opcodes(files)
     
     all_auc, all_acc = cv_on_filelist(files)
     import pdb; pdb.set_trace()
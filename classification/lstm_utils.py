@@ -5,31 +5,193 @@ import os
 import sys
 import argparse
 
+import json
+import struct
 import pandas as pd
 
 from keras.models import model_from_json
 
 THRESH = 0
+OPCODE_HEADER = '# opcodes '
+BLOCKS_HEADER = '# blocks '
+SPARSE_MAGIC = b'LSTMSPRS'
+SPARSE_RECORD_UNIT = 'U'
 
-def load_features(filename, max_bb):
+def is_sparse(filename):
+    '''Whether filename was written with -lstm-format=sparse'''
+    with open(filename, 'rb') as f:
+        return f.read(len(SPARSE_MAGIC)) == SPARSE_MAGIC
+
+def read_header(f):
+    '''Opcodes of the columns of the sparse file open as f, leaving f at the
+    first record'''
+    def varint():
+        value = 0
+        shift = 0
+        while True:
+            byte = ord(f.read(1))
+            value |= (byte & 0x7f) << shift
+            if byte < 0x80:
+                return value
+            shift += 7
+
+    f.seek(len(SPARSE_MAGIC))
+    version = varint()
+    if version != 1:
+        raise ValueError('{} has version {}'.format(f.name, version))
+    width = varint()
+    return [varint() for i in range(width)]
+
+def decode_varints(data):
+    '''Decodes data as if it were nothing but varints. Returns the values
+    and the index of the last byte of each; a varint starting right after
+    one of those bytes is the value at the same index.'''
+    ends = np.flatnonzero(data < 0x80)
+    if not len(ends):
+        return np.zeros(0, dtype=np.uint64), ends
+    starts = np.concatenate(([0], ends[:-1] + 1))
+    shift = np.arange(ends[-1] + 1) - np.repeat(starts, ends - starts + 1)
+    parts = (data[:ends[-1] + 1] & 0x7f).astype(np.uint64) << \
+        (7 * np.minimum(shift, 9)).astype(np.uint64)
+    return np.add.reduceat(parts, starts), ends
+
+# Decoded sparse files by name, as training loads every file once per fold
+sparse_files = {}
+
+def read_sparse(filename):
+    '''Opcodes of the columns, a list of (unit, path, count, number of blocks)
+    for each path of a sparse file, and the nonzero counts of all of them as
+    arrays of path index, block, column and value. Files are decoded once.'''
+    if filename in sparse_files:
+        return sparse_files[filename]
+
+    with open(filename, 'rb') as f:
+        opcodes = read_header(f)
+        body = np.frombuffer(f.read(), dtype=np.uint8)
+    values, ends = decode_varints(body)
+
+    # Walk the records by varint index; only the block counts are needed to
+    # find where each block, and so each path, ends
+    paths = []
+    block_starts = []
+    block_paths = []
+    block_rows = []
+    unit = None
+    pos = 0
+    while pos < len(body):
+        v = np.searchsorted(ends, pos) + 1   # varint after the record byte
+        if body[pos] == ord(SPARSE_RECORD_UNIT):
+            length = int(values[v])
+            pos = ends[v] + 1
+            unit = body[pos:pos + length].tobytes().decode('utf-8')
+            pos += length
+            continue
+        path, count, n_bb = [int(x) for x in values[v:v + 3]]
+        v += 3
+        for b in range(n_bb):
+            block_starts.append(v)
+            block_paths.append(len(paths))
+            block_rows.append(b)
+            v += 1 + 2 * int(values[v])
+        paths.append((unit, path, count, n_bb))
+        pos = ends[v - 1] + 1
+
+    # Each block is its number of nonzero counts, then a (gap, value) pair
+    # for each; the gaps skip the zero columns since the last count
+    block_starts = np.array(block_starts, dtype=int)
+    nonzero = values[block_starts].astype(int)
+    first = np.cumsum(nonzero) - nonzero
+    pair = np.arange(nonzero.sum()) - np.repeat(first, nonzero)
+    gap = np.repeat(block_starts + 1, nonzero) + 2 * pair
+    step = np.cumsum(values[gap].astype(int) + 1)
+    before = np.concatenate(([0], step))[first]
+    column = step - np.repeat(before, nonzero) - 1
+    entries = (np.repeat(np.array(block_paths, dtype=int), nonzero),
+               np.repeat(np.array(block_rows, dtype=int), nonzero),
+               column, values[gap + 1].astype(int))
+
+    sparse_files[filename] = (opcodes, paths, entries)
+    return sparse_files[filename]
+
+def read_opcodes(filename):
+    '''LLVM opcode of each feature column, from the header of the file.
+    Files from before the header have a column for each opcode below 100.'''
+    if is_sparse(filename):
+        with open(filename, 'rb') as f:
+            return read_header(f)
+    with open(filename) as f:
+        line = f.readline()
+    if not line.startswith(OPCODE_HEADER):
+        return list(range(100))
+    return [int(v) for v in line[len(OPCODE_HEADER):].strip('\n').split(',') if v]
+
+def get_opcodes(files):
+    '''Opcodes used in any of the files, so they can be loaded into the same
+    columns'''
+    opcodes = set()
+    for filename in files:
+        opcodes.update(read_opcodes(filename))
+    return sorted(opcodes)
+
+def read_rows(f, n):
+    '''The next n lines of f as an n x columns array of counts'''
+    return np.array([[int(v) for v in next(f).strip('\n').split(',')]
+                     for x in range(n)])
+
+def load_features(filename, max_bb, opcodes=None):
+    '''Loads a feature file with a column for each of opcodes, by default
+    the columns of the file itself. Indexed files (-lstm-format=indexed) give
+    each function's block rows once, under a "# blocks" line, and each path
+    as the indices of its blocks; their rows are gathered from the table.
+    Sparse files (-lstm-format=sparse) are binary; their nonzero counts are
+    scattered straight into the matrix.'''
     data = []
     y = []
     ids = []
     print('generate matrix for ' + filename)
+    file_opcodes = read_opcodes(filename)
+    if opcodes is None:
+        opcodes = file_opcodes
+    position = dict((op, i) for i, op in enumerate(opcodes))
+    keep = [i for i, op in enumerate(file_opcodes) if op in position]
+    target = [position[file_opcodes[i]] for i in keep]
+    if len(keep) < len(file_opcodes):
+        print('dropping {} opcodes missing from the model'.format(len(file_opcodes) - len(keep)))
+
+    if is_sparse(filename):
+        _, paths, (path, block, column, value) = read_sparse(filename)
+        y = [1 if truth > THRESH else 0 for _, _, truth, _ in paths]
+        ids = ['{} {}'.format(fn, ID) for fn, ID, _, _ in paths]
+        moved = -np.ones(len(file_opcodes), dtype=int)
+        moved[keep] = target
+        used = (moved[column] >= 0) & (block < max_bb)
+        X = np.zeros((len(paths), max_bb, len(opcodes)))
+        X[path[used], block[used], moved[column[used]]] = value[used]
+        return X, to_labels(y, max_bb), ids
+
+    blocks = None
     with open(filename) as f:
         while True:
             line = next(f, None)
             if not line:
                 break
+            if line.startswith(BLOCKS_HEADER):
+                n_blocks = int(line.strip('\n').split(' ')[-1])
+                blocks = read_rows(f, n_blocks)
+                continue
+            if line.startswith('#'):
+                continue
 
-            fn, ID, truth, n_bb = line.strip('\n').split(' ')
+            fields = line.strip('\n').split(' ')
+            fn, ID, truth, n_bb = fields[:4]
             truth = int(truth)
             n_bb = int(n_bb)
 
-            text_bbs = [next(f).strip('\n') for x in range(n_bb)]
-            num_bbs = [[int(v) for v in d.split(',')] for d in text_bbs]
-            bb_data = np.array(num_bbs)
-            next(f) # Should be empty line
+            if len(fields) == 5:
+                bb_data = blocks[[int(v) for v in fields[4].split(',')]]
+            else:
+                bb_data = read_rows(f, n_bb)
+                next(f) # Should be empty line
             if truth > THRESH:
                 y.append(1)
             else:
@@ -37,15 +199,24 @@ def load_features(filename, max_bb):
             data.append(bb_data)
             ids.append(fn + " " + ID)
 
-    X = np.ones((len(data), max_bb, 100)) * 0
+    return to_matrices(data, y, ids, max_bb, len(opcodes), keep, target)
+
+def to_matrices(data, y, ids, max_bb, width, keep, target):
+    '''Pads the paths to max_bb blocks and moves the columns keep of each
+    block to target'''
+    X = np.ones((len(data), max_bb, width)) * 0
     for i, d in enumerate(data):
         steps = d.shape[0]
-        X[i, 0:steps, :] = d
+        X[i, 0:steps][:, target] = d[:, keep]
+    return X, to_labels(y, max_bb), ids
+
+def to_labels(y, max_bb):
+    '''One-hot labels of the paths, repeated for each of max_bb blocks'''
     y = np.array(y)
     y = (np.arange(2) == y[:,None]).astype(int).reshape((-1, 2, 1))
     y = np.tile(y, (1, 1, max_bb))
     y = np.swapaxes(y, 1, 2)
-    return X, y, ids
+    return y
 
 def get_mask(X):
     mask_sum = X.sum(axis=2)
@@ -81,9 +252,18 @@ def load_model(fold_no):
     model.load_weights('saved_model_weights_{}.h5'.format(fold_no))
     return model
 
+def load_opcodes(fold_no):
+    '''Opcodes a model was trained on. Models saved without them were trained
+    on the headerless files, with a column for each opcode below 100.'''
+    filename = 'saved_model_opcodes_{}.json'.format(fold_no)
+    if not os.path.exists(filename):
+        return list(range(100))
+    with open(filename, 'r') as f:
+        return json.load(f)
 
-def infer_to_dataframe(filename, model):
-    X, y, ids = load_features(filename, args.b)
+
+def infer_to_dataframe(filename, model, opcodes):
+    X, y, ids = load_features(filename, args.b, opcodes)
     y_hat = model.predict(X, verbose=1)[:, :, 1]
     mask_len = get_mask(X)
     _, last_preds = calc_masked_means(mask_len, y_hat)
@@ -97,17 +277,55 @@ def infer_to_dataframe(filename, model):
     return frame
 
 
+def write_predictions(filename, frame):
+    '''Writes the yhat of frame, indexed by "function path" IDs, as a binary
+    prediction file for LSTMProfileSpooferPass (see PathPredictions.h)'''
+    functions = {}
+    for ID, yhat in zip(frame.index, frame['yhat']):
+        fn, path = ID.rsplit(' ', 1)
+        functions.setdefault(fn.encode('utf-8'), {})[int(path)] = float(yhat)
+
+    def align(offset):
+        return (offset + 63) & ~63
+
+    table, names, ids, scores = [], b'', [], []
+    for fn in sorted(functions):
+        paths = sorted(functions[fn].items())
+        table.append(struct.pack('<QQQQ', len(names), len(fn), len(ids), len(paths)))
+        names += fn
+        ids.extend(p for p, _ in paths)
+        scores.extend(s for _, s in paths)
+
+    functions_offset = align(56)
+    ids_offset = align(functions_offset + 32 * len(table))
+    scores_offset = align(ids_offset + 8 * len(ids))
+    names_offset = align(scores_offset + 8 * len(scores))
+    with open(filename, 'wb') as f:
+        f.write(struct.pack('<8sIIQQQQQ', b'PATHPRED', 1, len(table), len(ids),
+                            functions_offset, ids_offset, scores_offset, names_offset))
+        for offset, data in [(functions_offset, b''.join(table)),
+                             (ids_offset, np.array(ids, dtype='<u8').tobytes()),
+                             (scores_offset, np.array(scores, dtype='<f8').tobytes()),
+                             (names_offset, names)]:
+            f.write(b'\0' * (offset - f.tell()))
+            f.write(data)
+
+
 def main():
     global args
     parser = argparse.ArgumentParser(description='Save predictions from LSTM model, given feature input')
     parser.add_argument('-i', help='Feature input filename')
-    parser.add_argument('-o', help='Output CSV mapping IDs to probabilities')
+    parser.add_argument('-o', help='Output CSV mapping IDs to probabilities, or a binary '
+                        'prediction file if it ends in .bin')
     parser.add_argument('-b', type=int, help='Max number of basic blocks')
     args = parser.parse_args()
 
     model = load_model(0)
-    frame = infer_to_dataframe(args.i, model)
-    frame.to_csv(args.o, ',')
+    frame = infer_to_dataframe(args.i, model, load_opcodes(0))
+    if args.o.endswith('.bin'):
+        write_predictions(args.o, frame)
+    else:
+        frame.to_csv(args.o, ',')
     print('Wrote output to {}'.format(args.o))
 
 
@@ -1,3 +1,5 @@
+import os
+
 import pandas as pd
 import numpy as np
 
@@ -8,21 +10,58 @@ from keras.models import Sequential
 from keras.layers.core import Dense, Dropout, Activation
 from keras.optimizers import SGD
 
-N_FEATURES = 15
+from feature_file import FeatureFile
+
+CSV_FILE = 'feature_output.csv'
+BINARY_FILE = 'feature_output.bin'
 N_EPOCH = 40
 THRESH = 0
 
 
-def build_model():
+def build_model(n_features):
     """Build a simple model with one hidden layer and a softmax output"""
     model = Sequential()
-    model.add(Dense(128, input_dim=N_FEATURES, init='uniform', activation='tanh'))
+    model.add(Dense(128, input_dim=n_features, init='uniform', activation='tanh'))
     model.add(Dense(2, init='uniform', activation='softmax'))
 
     model.compile(loss='categorical_crossentropy', optimizer='rmsprop')
     return model
 
 
+def feature_file():
+    """
+    The feature file to train on: the newer of the binary and csv output, so
+    a stale file left by an earlier -static-estimation-format is never picked up
+    """
+    files = [f for f in (BINARY_FILE, CSV_FILE) if os.path.exists(f)]
+    if not files:
+        raise IOError('neither {} nor {} exists'.format(BINARY_FILE, CSV_FILE))
+    return max(files, key=os.path.getmtime)
+
+
+def count_features(filename):
+    """Number of feature columns of the extracted paths"""
+    if filename == BINARY_FILE:
+        return FeatureFile(filename).n_features
+    # ID and RealCount come first
+    return len(pd.read_csv(filename, sep=',', nrows=0).columns) - 2
+
+
+def read_chunks(filename, chunksize):
+    """
+    (counts, X) a chunk of paths at a time, from the binary feature file,
+    which needs no parsing, or the csv
+    """
+    if filename == BINARY_FILE:
+        for counts, X in FeatureFile(filename).chunks(chunksize):
+            yield counts, X
+        return
+
+    reader = pd.read_csv(filename, sep=',', chunksize=chunksize, index_col=0)
+    for chunk in reader:
+        yield chunk['RealCount'].values, (chunk.iloc[:, 1:]).values
+
+
 def main():
     """
     Train an MLP on our data for a set number of epochs. Note there is 
@@ -35,17 +74,18 @@ def main():
     the metric for discrimination. Even so, maybe in the future we'll want to weight
     positive instances much higher than negative.
     """
+    filename = feature_file()
+    print("Loading features from {}".format(filename))
+
     # Compile the MLP
-    model = build_model()
+    model = build_model(count_features(filename))
     
     aucs = []
     for E in range(N_EPOCH):
-        # Read the csv but in chunks because it's so big
-        reader = pd.read_csv('feature_output.csv', sep=',', chunksize=500000, index_col=0)
-        for i, chunk in enumerate(reader):
-            y = (chunk['RealCount'] > THRESH).astype(int).values
+        # Read the paths in chunks because there are so many
+        for i, (counts, X) in enumerate(read_chunks(filename, 500000)):
+            y = (counts > THRESH).astype(int)
             y = (np.arange(2) == y[:,None]).astype(int)
-            X = (chunk.iloc[:, 1:]).values
 
             model.train_on_batch(X, y)
             print("Training on batch {}".format(i))
@@ -53,11 +93,9 @@ def main():
         # Run testing in batches
         y_real = []
         y_hat = []
-        reader = pd.read_csv('feature_output.csv', sep=',', chunksize=1000000, index_col=0)
-        for i, chunk in enumerate(reader):
-            y = (chunk['RealCount'] > THRESH).astype(int).values
+        for i, (counts, X) in enumerate(read_chunks(filename, 1000000)):
+            y = (counts > THRESH).astype(int)
             y = (np.arange(2) == y[:,None]).astype(int)
-            X = (chunk.iloc[:, 1:]).values
 
             pred = model.predict(X)
             print("Testing on batch {}".format(i))
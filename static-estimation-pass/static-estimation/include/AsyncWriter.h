@@ -0,0 +1,87 @@
+#ifndef ASYNCWRITER_H
+#define ASYNCWRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Size of each output buffer, in bytes
+#define ASYNC_BUFFER_SIZE (4 << 20)
+
+// A stream buffer that hands full buffers to a writer thread instead of
+// writing them itself. There is a fixed number of buffers: one is being
+// filled while the others wait for, or are in, a write. Once they are all
+// taken, the next write blocks until the disk catches up, so memory stays
+// bounded however far extraction runs ahead.
+class AsyncWriteBuffer : public std::streambuf {
+public:
+  AsyncWriteBuffer(size_t bufferSize, unsigned nBuffers);
+  ~AsyncWriteBuffer();
+
+  // Opens fname and starts the writer thread
+  bool open(const std::string& fname, std::ios_base::openmode mode);
+
+  // Writes out everything buffered, stops the writer thread and closes the
+  // file. Returns false if any write failed.
+  bool close();
+
+  bool is_open() const { return _open; }
+
+protected:
+  int_type overflow(int_type c);
+  std::streamsize xsputn(const char* s, std::streamsize n);
+  // Hands the current buffer to the writer without waiting for the write
+  int sync();
+
+private:
+  struct Block {
+    unsigned buffer;
+    size_t size;
+  };
+
+  size_t _bufferSize;
+  std::vector<std::vector<char> > _buffers;
+  unsigned _current;              // buffer being filled
+
+  // Only the writer thread touches _file while it runs; the producer side
+  // goes by _open, which only open() and close() change
+  std::ofstream _file;
+  bool _open;
+  std::thread _writer;
+  std::mutex _lock;
+  std::condition_variable _changed;
+  std::deque<Block> _pending;     // filled buffers, in write order
+  std::vector<unsigned> _free;    // buffers nobody is using
+  bool _stopping;
+  bool _failed;
+
+  // Queues the current buffer and makes a free one current, waiting for
+  // the writer if there is none
+  void submit();
+  void writeLoop();
+};
+
+// An output file stream whose writes go through an AsyncWriteBuffer, for
+// the passes' feature files.
+class AsyncOutputFile : public std::ostream {
+public:
+  AsyncOutputFile(size_t bufferSize = ASYNC_BUFFER_SIZE, unsigned nBuffers = 2);
+
+  void open(const std::string& fname,
+            std::ios_base::openmode mode = std::ios_base::out);
+  void close();
+
+  bool is_open() const { return _buffer.is_open(); }
+
+private:
+  AsyncWriteBuffer _buffer;
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef BLINSTRUMENTATION_H
+#define BLINSTRUMENTATION_H
+
 #include "llvm/Transforms/Instrumentation.h"
 #include "ProfilingUtils.h"
 #include "llvm/Analysis/PathNumbering.h"
@@ -205,3 +208,4 @@ private:
   int calculateChordIncrementsDir(BallLarusEdge* e, BallLarusEdge* f);
 };
 
+#endif
@@ -0,0 +1,93 @@
+#ifndef BLOCKFEATURES_H
+#define BLOCKFEATURES_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+
+#include <vector>
+
+#include "OpcodeHistogram.h"
+
+using namespace llvm;
+
+// Everything path features are computed from that is a plain sum over the
+// blocks of the path. Counting a block once and adding up the counts gives
+// the same features as walking every instruction of the path.
+struct BlockFeatures {
+    unsigned n_blocks;
+    unsigned n_instructions;
+
+    // Instruction classes, see OpStatCounter
+    unsigned integerALU;
+    unsigned floatingALU;
+    unsigned memory;
+    unsigned loads;
+    unsigned stores;
+    unsigned alloca;
+    unsigned branch;
+    unsigned compares;
+    unsigned equality_checks;
+    unsigned relational_checks;
+    unsigned other;
+
+    unsigned n_globals;
+    unsigned n_locals;
+    unsigned n_function_calls;
+    unsigned n_params;
+    unsigned n_tries;
+    unsigned n_catches;
+
+    // All zero
+    BlockFeatures();
+
+    // Counts of a single block. With a vocabulary the opcode histogram of
+    // the block is filled into opcodeRow in the same walk.
+    explicit BlockFeatures(BasicBlock* BB, const OpcodeVocabulary* vocab = NULL,
+                           unsigned* opcodeRow = NULL);
+
+    BlockFeatures& operator+=(const BlockFeatures& other);
+    BlockFeatures& operator-=(const BlockFeatures& other);
+};
+
+// Per-function cache of the block counts, and of each block's opcode
+// histogram for the LSTM features. It is only read once built, so any
+// number of threads can share it.
+class BlockFeatureTable {
+    DenseMap<BasicBlock*, unsigned> index;
+    std::vector<BlockFeatures> blocks;
+    OpcodeRows opcodes;
+    unsigned opcodeWidth;
+
+        void build(Function& F, const OpcodeVocabulary* vocab);
+
+    public:
+        // Block counts only, for the path features
+        explicit BlockFeatureTable(Function& F);
+        // Block counts and opcode histograms over vocab
+        BlockFeatureTable(Function& F, const OpcodeVocabulary& vocab);
+
+        const BlockFeatures& getFeatures(BasicBlock* BB) const;
+
+        // Blocks are numbered 0..getNumberOfBlocks()-1 in function order
+        unsigned getNumberOfBlocks() const {
+            return blocks.size();
+        }
+        unsigned getIndex(BasicBlock* BB) const;
+
+        // Number of times each opcode of the vocabulary occurs in BB, a
+        // 64 byte aligned row of OPCODE_ROW_WIDTH counters. Only for
+        // tables built with a vocabulary.
+        const unsigned* getOpcodes(BasicBlock* BB) const;
+        const unsigned* getOpcodes(unsigned block) const {
+            return opcodes.getRow(block);
+        }
+
+        // Columns of the vocabulary the rows were counted with, 0 without
+        // one
+        unsigned getOpcodeWidth() const {
+            return opcodeWidth;
+        }
+};
+
+#endif
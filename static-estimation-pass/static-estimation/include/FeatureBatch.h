@@ -0,0 +1,59 @@
+#ifndef FEATUREBATCH_H
+#define FEATUREBATCH_H
+
+#include "llvm/ADT/ArrayRef.h"
+
+#include <cstddef>
+
+#include "BlockFeatures.h"
+#include "FeatureExtractor.h"
+#include "PathEnumerator.h"
+
+using namespace llvm;
+
+// How a batch of feature rows is laid out. Row major puts the features of
+// a path next to each other: matrix[row * stride + feature]. Column major
+// puts each feature of the batch next to each other:
+// matrix[feature * stride + row].
+enum MatrixLayout {
+    RowMajor,
+    ColumnMajor
+};
+
+// Fills a caller provided float matrix with the features of many paths of
+// one function, NUM_FEATURES columns indexed by FeatureID. The extractor
+// and its buffers are reused across rows and batches.
+class FeatureBatch {
+    FeatureExtractor features;
+    // The enumerator whose previous path the extractor holds, if any
+    const PathEnumerator* following;
+
+    MatrixLayout layout;
+    float* matrix;
+    size_t stride;
+
+    public:
+        FeatureBatch(const BlockFeatureTable& blockTable);
+
+        // Sets the matrix the rows go to. stride is the distance between
+        // rows (row major) or columns (column major), in floats.
+        void setMatrix(MatrixLayout matrixLayout, float* values, size_t valueStride);
+
+        // Row row gets the features of path
+        void fillRow(unsigned row, ArrayRef<BasicBlock*> path);
+
+        // Row i gets the features of path ids[i] of dag
+        void fill(const FlatPathDag& dag, ArrayRef<PathID> ids);
+
+        // Fills up to maxRows rows with the next paths of paths, whose
+        // numbers go to ids. Consecutive paths only add and remove the
+        // blocks they do not share. Returns the number of rows filled,
+        // which is 0 once paths is done.
+        unsigned fill(PathEnumerator& paths, unsigned maxRows, PathID* ids);
+
+    private:
+        // Copies the features of the current path to row
+        void storeRow(unsigned row);
+};
+
+#endif
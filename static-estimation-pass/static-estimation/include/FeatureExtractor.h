@@ -1,6 +1,7 @@
 #ifndef FTEXT_H
 #define FTEXT_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Instructions.h"
@@ -9,41 +10,93 @@
 #include <vector>
 #include <utility>
 #include <string>
-#include <sstream>
-#include <iomanip>
+
+#include "BlockFeatures.h"
 
 
 using namespace llvm;
 
-typedef std::map<std::string, float> featuremap;
-typedef std::pair<std::string, float> featurepair;
-typedef std::map<unsigned, unsigned> instvector;
+// Every feature of a path, in the order of the CSV columns. The columns
+// stay in alphabetical order, as they were when features were kept in a
+// map keyed by name; new features go where their name sorts.
+enum FeatureID {
+    F_N_AVG_ARGS_PER_CALL,
+    F_N_BASICBLOCKS,
+    F_N_CATCHES,
+    F_N_FUNCTION_CALLS,
+    F_N_GLOBALS,
+    F_N_LOCALS,
+    F_N_TRIES,
+    F_PERCENT_ALLOCA,
+    F_PERCENT_BRANCHOPS,
+    F_PERCENT_COMPARES,
+    F_PERCENT_EQUALITY_CHECKS,
+    F_PERCENT_FLOATOPS,
+    F_PERCENT_INTOPS,
+    F_PERCENT_LOADS,
+    F_PERCENT_MEMOPS,
+    F_PERCENT_OTHEROPS,
+    F_PERCENT_RELATIONAL_CHECKS,
+    F_PERCENT_STORES,
+    F_TOTAL_INSTRUCTIONS,
+    NUM_FEATURES
+};
 
 class FeatureExtractor {
-    featuremap features;
-    // We'll keep both the instruction list and BB path in memory
-    // in an attempt to not throw away information. IRSet gets built
-    // during object construction and won't change, however
-    std::vector<Instruction*> InstPath;
+    float features[NUM_FEATURES];
+    // The BB path and the sum of its block counts, from which every
+    // feature is computed. The path buffer is kept from path to path, so
+    // a reused extractor stops allocating once it has seen the longest.
     std::vector<BasicBlock*> BBPath;
+    BlockFeatures counts;
+    // Cached block counts of the function, if the caller has them
+    const BlockFeatureTable* table;
     
     public:
-        FeatureExtractor(std::vector<BasicBlock*> path);
+        FeatureExtractor(ArrayRef<BasicBlock*> path);
+        FeatureExtractor(ArrayRef<BasicBlock*> path,
+                         const BlockFeatureTable& blockTable);
+        // Starts with an empty path, to be set with setPath() or built up
+        // with pushBlock()
+        FeatureExtractor(const BlockFeatureTable& blockTable);
+
+        // Replaces the path, which is copied into the reused buffer. Only
+        // for extractors built with a table.
+        void setPath(ArrayRef<BasicBlock*> path);
+
+        // Appends BB to the path, or removes the last block, adjusting the
+        // counts by that one block. Only for extractors built with a table.
+        void pushBlock(BasicBlock* BB);
+        void popBlock();
+        unsigned getPathLength() const {
+            return BBPath.size();
+        }
 
-        static instvector getBlockInstVec(BasicBlock* BB);
         void extractFeatures();
         void countTryCatch();
         void countInstructionTypes();
         void countHighLevelFeatures();
-        void countEqualities();
         void countLocalGlobalVars();
         void countCallInfo();
 
         std::string getFeaturesLSTM();
         std::string getFeaturesCSV();
-        std::string getFeaturesCSVNames();
+        static std::string getFeaturesCSVNames();
+
+        // Same as above, appended to out, which callers keep from path to
+        // path
+        void appendFeaturesLSTM(std::string& out);
+        void appendFeaturesCSV(std::string& out);
+
+        // Appends a CSV line of NUM_FEATURES values, such as a row of a
+        // FeatureBatch
+        static void appendCSV(std::string& out, const float* values);
+
+        // Column name of a feature
+        static const char* getFeatureName(unsigned id);
 
-        featuremap getFeatures() {
+        // NUM_FEATURES values, indexed by FeatureID
+        const float* getFeatures() const {
             return features;
         }
 };
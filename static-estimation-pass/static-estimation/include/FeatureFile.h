@@ -0,0 +1,70 @@
+#ifndef FEATUREFILE_H
+#define FEATUREFILE_H
+
+#include "PathID.h"
+
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Binary, columnar path feature file. Everything is little endian:
+//
+//   FeatureFileHeader
+//   names            NUM_FEATURES feature names, then nUnits unit names,
+//                    each a uint32 length followed by the bytes
+//   unit column      uint32[nRows], index of the row's unit name
+//   path column      uint64[nRows], path number within the unit
+//   count column     uint32[nRows], profiled count
+//   feature columns  float32[nRows] per feature, in FeatureID order
+//
+// Every section starts on a 64 byte boundary at the offset recorded in the
+// header, so the columns can be mapped as they are (numpy.memmap). Rows are
+// in the order of the CSV output and the ID of a row is the name of its
+// unit, a dot and its path number.
+// ---------------------------------------------------------------------------
+struct FeatureFileHeader {
+  char magic[8];            // "PATHFEAT"
+  uint32_t version;         // 1
+  uint32_t nFeatures;
+  uint64_t nRows;
+  uint32_t nUnits;
+  uint32_t reserved;
+  uint64_t namesOffset;
+  uint64_t unitOffset;
+  uint64_t pathOffset;
+  uint64_t countOffset;
+  uint64_t featureOffset;
+};
+
+class FeatureFileWriter {
+public:
+  // Creates fname for nRows rows spread over the named units and writes
+  // everything but the rows.
+  FeatureFileWriter(const std::string& fname,
+                    const std::vector<std::string>& unitNames, uint64_t nRows);
+
+  bool good() const { return _file.good(); }
+
+  // Writes the nRows rows from firstRow on, which all belong to unit.
+  // features holds NUM_FEATURES columns of stride floats each (column
+  // major). Safe to call from several threads at once.
+  void writeRows(uint64_t firstRow, unsigned nRows, unsigned unit,
+                 const PathID* paths, const unsigned* counts,
+                 const float* features, size_t stride);
+
+private:
+  std::ofstream _file;
+  std::mutex _lock;
+  FeatureFileHeader _header;
+  std::vector<char> _scratch;
+
+  // Writes n values of size bytes each at offset, byte swapped to little
+  // endian if needed. Called with _lock held.
+  void writeAt(uint64_t offset, const void* values, size_t size, size_t n);
+};
+
+#endif
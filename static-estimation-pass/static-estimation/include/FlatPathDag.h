@@ -0,0 +1,110 @@
+#ifndef FLATPATHDAG_H
+#define FLATPATHDAG_H
+
+#include "BLInstrumentation.h"
+#include "PathID.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+// ---------------------------------------------------------------------------
+// FlatPathDag is a compact, read-only snapshot of a numbered
+// BLInstrumentationDag. Nodes are numbered 0..n-1 with the root at 0 and
+// the successors of node n are the edges succBegin(n)..succEnd(n)-1, stored
+// in flat arrays sorted by weight (compressed sparse rows). Only edges that
+// lie on some numbered path are kept.
+//
+// Decoding a path number walks these arrays instead of the BallLarusNode /
+// BallLarusEdge heap objects, and the snapshot can be shared by any number
+// of threads once built.
+//
+// The dag must have been through calculatePathNumbers, which splits every
+// node below the root with more than 100000000 paths: its successor edges
+// become split edges, and paths end at the node and start again at the
+// successors through phony edges. That split dag is what LLVM's profiler
+// numbers. Paths are numbered here again over the same edges in the same
+// order, but in 64 bits, so the IDs are LLVM's wherever the function has at
+// most 2^32 paths, and go on past 2^32 where LLVM's wrap around.
+// ---------------------------------------------------------------------------
+class FlatPathDag {
+public:
+  // Snapshots dag, on which calculatePathNumbers has run, and numbers its
+  // paths. If there are 2^64 paths or more, hasOverflow() is set and the
+  // dag has no paths at all.
+  FlatPathDag(BLInstrumentationDag* dag);
+
+  // Copies the part of dag made up of nodes, which must be in topological
+  // order and only have successors among themselves, and numbers its
+  // paths. nodes.front() becomes the root and nodes.back() the exit.
+  FlatPathDag(const FlatPathDag& dag, const std::vector<unsigned>& nodes);
+
+  // False for the back and split edges that calculatePathNumbers skips;
+  // they stay in the successor lists but never appear on a numbered path.
+  static bool isNumberedEdge(BallLarusEdge* edge);
+
+  Function* getFunction() const { return _function; }
+
+  unsigned getRoot() const { return 0; }
+  unsigned getExit() const { return _exit; }
+  unsigned getNumberOfNodes() const { return _blocks.size(); }
+  PathID getNumberOfPaths() const { return _overflow ? 0 : _numberPaths[0]; }
+
+  // True if the paths do not fit in a PathID.
+  bool hasOverflow() const { return _overflow; }
+
+  // Block of a node; NULL for the exit node of a whole function.
+  BasicBlock* getBlock(unsigned node) const { return _blocks[node]; }
+
+  // Number of paths from node to the exit.
+  PathID getNumberPaths(unsigned node) const { return _numberPaths[node]; }
+
+  // Successor edges of node.
+  unsigned succBegin(unsigned node) const { return _edgeBegin[node]; }
+  unsigned succEnd(unsigned node) const { return _edgeBegin[node + 1]; }
+
+  unsigned getTarget(unsigned edge) const { return _edgeTarget[edge]; }
+  PathID getWeight(unsigned edge) const { return _edgeWeight[edge]; }
+
+  // Type of an edge. The phony edges out of the root and into the exit
+  // stand for a back, split or call edge rather than a CFG edge.
+  BallLarusEdge::EdgeType getType(unsigned edge) const {
+    return _edgeType[edge];
+  }
+
+  // For a phony edge out of the root made for a back or split edge, the
+  // block that edge comes from; the path resumes at the target of the
+  // phony edge. NULL for every other edge.
+  BasicBlock* getRealSource(unsigned edge) const {
+    return _edgeRealSource[edge];
+  }
+
+  // The successor edge of node that a path with remaining number R takes:
+  // the one with the largest weight <= R.
+  unsigned selectEdge(unsigned node, PathID R) const {
+    const PathID* begin = _edgeWeight.data() + succBegin(node);
+    const PathID* end = _edgeWeight.data() + succEnd(node);
+    return std::upper_bound(begin, end, R) - _edgeWeight.data() - 1;
+  }
+
+private:
+  Function* _function;
+  unsigned _exit;
+  bool _overflow;
+
+  std::vector<BasicBlock*> _blocks;   // per node
+  std::vector<PathID> _numberPaths;   // per node
+  std::vector<unsigned> _edgeBegin;   // per node, plus one past the end
+  std::vector<unsigned> _edgeTarget;  // per edge
+  std::vector<PathID> _edgeWeight;    // per edge
+  std::vector<BallLarusEdge::EdgeType> _edgeType;  // per edge
+  std::vector<BasicBlock*> _edgeRealSource;        // per edge
+};
+
+// Builds the Ball-Larus dag of F, has calculatePathNumbers split it like
+// LLVM's path profiler does, and numbers its paths again in a FlatPathDag.
+// The caller owns the result.
+FlatPathDag* buildFlatPathDag(Function& F);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef NUMBERFORMAT_H
+#define NUMBERFORMAT_H
+
+#include <stdint.h>
+#include <string>
+
+// Text formatting for the feature files, without streams, locales or
+// allocations. Each write* function writes to p, which must have room for
+// the longest result, and returns the end of what it wrote.
+
+// Longest output of writeFeature, plus room to spare
+#define MAX_FEATURE_CHARS 32
+
+// n in decimal, at most 20 characters
+char* writeUnsigned(char* p, uint64_t n);
+
+// value exactly as printf("%4g") prints it: six significant digits,
+// trailing zeros removed, padded to four characters
+char* writeFeature(char* p, float value);
+
+inline void appendUnsigned(std::string& out, uint64_t n) {
+    char buf[20];
+    out.append(buf, writeUnsigned(buf, n));
+}
+
+inline void appendFeature(std::string& out, float value) {
+    char buf[MAX_FEATURE_CHARS];
+    out.append(buf, writeFeature(buf, value));
+}
+
+#endif
@@ -7,34 +7,24 @@
 #include "llvm/IR/Type.h"
 
 #include "FeatureExtractor.h"
+#include "BlockFeatures.h"
 
 #include <vector>
 
 using namespace llvm;
 
 class OpStatCounter {
-    featuremap opstats;
-    std::vector<Instruction*> IRSet;
-
-    long integerALU;
-    long floatingALU;
-    long memory;
-    long loads;
-    long stores;
-    long other;
-    long branch;
-    long all;
-    long alloca;
-    long compares;
-    long equality_checks;
-    long relational_checks;
-
-    void run_counts();
+    // Instruction counts of the whole path
+    const BlockFeatures& counts;
 
     public:
         float get_percentage(int val);
-        OpStatCounter(std::vector<Instruction*> pathInsts);
-        featuremap get_opstats();
+        OpStatCounter(const BlockFeatures& pathCounts);
+        // Fills in the percent_* entries of features, indexed by FeatureID
+        void get_opstats(float* features);
+
+        // Adds inst to the instruction counters of counts
+        static void count_instruction(Instruction* inst, BlockFeatures& counts);
 };
 
 #endif
@@ -0,0 +1,76 @@
+#ifndef OPCODEHIST_H
+#define OPCODEHIST_H
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// Every LLVM opcode is below this. Opcodes start at 1, so the first
+// column of the full vocabulary is always zero.
+#define MAX_OPCODE Instruction::OtherOpsEnd
+
+// Counters per histogram row: MAX_OPCODE rounded up to whole 64 byte
+// lines. The padding is always zero.
+#define OPCODE_ROW_WIDTH ((MAX_OPCODE + 15) & ~15u)
+
+// Which histogram column each opcode is counted in. The full vocabulary
+// gives every opcode below MAX_OPCODE its own column; a compact one only
+// has columns for the opcodes that occur in a module.
+class OpcodeVocabulary {
+    unsigned columns[MAX_OPCODE];
+    std::vector<unsigned> opcodes;  // opcode of each column
+
+    public:
+        // Column i counts opcode i
+        OpcodeVocabulary();
+        // Only the opcodes used in M, in increasing order
+        explicit OpcodeVocabulary(Module& M);
+
+        unsigned getWidth() const {
+            return opcodes.size();
+        }
+
+        // Opcode of each column
+        const std::vector<unsigned>& getOpcodes() const {
+            return opcodes;
+        }
+
+        // Column of opcode, or getWidth() if it has none
+        unsigned getColumn(unsigned opcode) const;
+
+        // First line of an LSTM feature file: "# opcodes" and the opcode
+        // of each column
+        std::string getHeader() const;
+};
+
+// Number of times each opcode of vocab occurs in BB, written to row, which
+// holds OPCODE_ROW_WIDTH counters.
+void countOpcodes(BasicBlock* BB, const OpcodeVocabulary& vocab, unsigned* row);
+
+// Appends row[0..width) to out as one line of comma separated counts. row
+// must be 16 byte aligned.
+void writeOpcodeRow(std::string& out, const unsigned* row, unsigned width);
+
+// Histogram rows of a fixed number of blocks, each starting on a 64 byte
+// boundary.
+class OpcodeRows {
+    std::vector<unsigned> storage;
+    unsigned offset;
+
+    public:
+        OpcodeRows(unsigned nRows = 0);
+
+        unsigned* getRow(unsigned r) {
+            return &storage[offset + r * OPCODE_ROW_WIDTH];
+        }
+        const unsigned* getRow(unsigned r) const {
+            return &storage[offset + r * OPCODE_ROW_WIDTH];
+        }
+};
+
+#endif
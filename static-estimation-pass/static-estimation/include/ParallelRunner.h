@@ -0,0 +1,62 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "PathID.h"
+
+#include <functional>
+#include <ostream>
+#include <vector>
+
+using namespace llvm;
+
+// A unit of work handed to runOrdered. Features go to out and progress
+// messages to log; both are buffered per task.
+typedef std::function<void(unsigned task, std::ostream& out, raw_ostream& log)> OrderedTask;
+
+// Called on the calling thread, in task order, right after a task's buffers
+// have been flushed.
+typedef std::function<void(unsigned task)> OrderedDone;
+
+// Runs tasks 0..nTasks-1 on nThreads worker threads. Idle workers always
+// take the lowest task nobody has started yet. Each task writes into its
+// own buffers, which are flushed to out (and the log to errs()) in task
+// order as soon as every earlier task has finished, so the output is
+// byte-identical to running the tasks one after another. Workers only run
+// a few tasks per thread ahead of the flushed output, which bounds the
+// memory held in buffers when out is slow.
+void runOrdered(unsigned nThreads, unsigned nTasks, const OrderedTask& task,
+                std::ostream& out, const OrderedDone& done = OrderedDone());
+
+// A contiguous range [first, last) of the path numbers of one function.
+struct PathRange {
+  unsigned function;
+  PathID first;
+  PathID last;
+};
+
+// The paths of every function cut into ranges of chunkSize paths, in
+// function order. A single function with most of the paths thus becomes
+// many tasks that all workers can share. Ranges are worked out from their
+// task number when asked for, and a function with more than
+// MAX_FUNCTION_RANGES chunks gets larger chunks instead, so 64 bit path
+// counts take neither memory nor time up front.
+class PathRanges {
+public:
+  PathRanges(const std::vector<PathID>& nPaths, PathID chunkSize);
+
+  unsigned size() const { return _firstRange.back(); }
+  PathRange operator[](unsigned t) const;
+
+private:
+  std::vector<PathID> _nPaths;         // per function
+  std::vector<PathID> _chunkSize;      // per function
+  std::vector<unsigned> _firstRange;   // per function, plus one past the end
+};
+
+// Number of worker threads to use for a thread-count option, where 0 means
+// one per hardware thread.
+unsigned getWorkerCount(unsigned requested);
+
+#endif
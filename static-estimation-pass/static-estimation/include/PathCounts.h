@@ -0,0 +1,27 @@
+#ifndef PATHCOUNTS_H
+#define PATHCOUNTS_H
+
+#include "llvm/Analysis/PathProfileInfo.h"
+#include "llvm/IR/Function.h"
+
+#include "FlatPathDag.h"
+#include "PathID.h"
+
+#include <map>
+
+using namespace llvm;
+
+// Executed path number -> profiled count for one function. This is a copy
+// of what PathProfileInfo holds, so worker threads never have to touch its
+// current-function state.
+typedef std::map<PathID, unsigned> PathCounts;
+
+// Copies the executed paths of F out of PI.
+PathCounts getPathCounts(PathProfileInfo* PI, Function* F);
+
+// LLVM's path profiler numbers paths with 32 bit unsigneds. Past 2^32 paths
+// its IDs wrap around and cannot be told apart, so the counts of such a
+// function match no path of dag and it is left unlabelled.
+bool hasProfiledNumbers(const FlatPathDag& dag);
+
+#endif
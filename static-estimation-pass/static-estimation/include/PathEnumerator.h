@@ -0,0 +1,92 @@
+#ifndef PATHENUM_H
+#define PATHENUM_H
+
+#include "FlatPathDag.h"
+
+#include <vector>
+
+using namespace llvm;
+
+// ---------------------------------------------------------------------------
+// PathEnumerator walks a FlatPathDag once in depth first order and yields
+// every root->exit path together with its Ball-Larus path number. Siblings
+// share the prefix that is already on the stack, so moving from one path to
+// the next only touches the blocks that differ.
+//
+// Successor edges are sorted by weight, so paths come out in increasing
+// path number order.
+// ---------------------------------------------------------------------------
+class PathEnumerator {
+public:
+  PathEnumerator(const FlatPathDag& dag);
+
+  // Enumerates only the paths numbered [first, last). The DFS stack is
+  // rebuilt along path first, so any range can be started without walking
+  // the paths in front of it.
+  PathEnumerator(const FlatPathDag& dag, PathID first, PathID last);
+
+  // Advances to the next path. Returns false once every path of the range
+  // has been produced.
+  bool next();
+
+  // Path number of the current path.
+  PathID getPathNumber() const;
+
+  // Blocks of the current path, starting at the entry block. The exit
+  // node has no block and is not included.
+  const std::vector<BasicBlock*>& getPath() const;
+
+  // Number of leading blocks of the current path that are unchanged since
+  // the previous call to next().
+  unsigned getSharedPrefix() const;
+
+private:
+  // One DFS level: the node, the next successor edge to try and the path
+  // number accumulated on the way to the node.
+  struct Frame {
+    unsigned node;
+    unsigned next;
+    unsigned end;
+    PathID base;
+  };
+
+  const FlatPathDag& _dag;
+  std::vector<Frame> _stack;
+  std::vector<BasicBlock*> _path;
+  PathID _pathNumber;
+  PathID _last;
+  unsigned _sharedPrefix;
+  bool _started;
+
+  // Pushes node onto the DFS stack and its block onto the current path.
+  void push(unsigned node, PathID base);
+
+  // Positions the DFS stack so that the next call to next() yields path
+  // pathNo, or empties it if there is no such path.
+  void seek(PathID pathNo);
+};
+
+// ---------------------------------------------------------------------------
+// PathDecoder turns single path numbers into block sequences. The block
+// vector is reused from call to call, so decoding does not allocate once it
+// has grown to the longest path.
+// ---------------------------------------------------------------------------
+class PathDecoder {
+public:
+  PathDecoder(const FlatPathDag& dag);
+
+  // Decodes pathNo, which must be below getNumberOfPaths(). The result is
+  // overwritten by the next call.
+  const std::vector<BasicBlock*>& decode(PathID pathNo);
+
+  // Edges of the path decoded last, one per block: block j leaves the
+  // path through edge j, and the last edge leads to the exit.
+  const std::vector<unsigned>& getEdges() const { return _edges; }
+
+private:
+  const FlatPathDag& _dag;
+  std::vector<BasicBlock*> _path;
+  std::vector<unsigned> _edges;
+};
+
+#endif
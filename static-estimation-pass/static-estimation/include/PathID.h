@@ -0,0 +1,11 @@
+#ifndef PATHID_H
+#define PATHID_H
+
+#include <stdint.h>
+
+// A Ball-Larus path number. LLVM numbers paths with 32 bit unsigneds, which
+// wrap around for large CFGs; these are 64 bits wide from numbering through
+// decoding, sampling and output.
+typedef uint64_t PathID;
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PATHPREDICTIONS_H
+#define PATHPREDICTIONS_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "PathID.h"
+
+// ---------------------------------------------------------------------------
+// Binary prediction file, little endian, made to be mapped as it is:
+//
+//   PredictionFileHeader
+//   functions   PredictionFileFunction[nFunctions], sorted by name
+//   ids         uint64[nPredictions], each function's path IDs ascending
+//   scores      float64[nPredictions], the score of each path ID
+//   names       the bytes of the function names
+//
+// Sections start on 64 byte boundaries at the offsets in the header.
+// ---------------------------------------------------------------------------
+struct PredictionFileHeader {
+  char magic[8];            // "PATHPRED"
+  uint32_t version;         // 1
+  uint32_t nFunctions;
+  uint64_t nPredictions;
+  uint64_t functionsOffset;
+  uint64_t idsOffset;
+  uint64_t scoresOffset;
+  uint64_t namesOffset;
+};
+
+struct PredictionFileFunction {
+  uint64_t nameOffset;      // from the start of the names section
+  uint64_t nameLength;
+  uint64_t first;           // index of the first path ID and score
+  uint64_t count;
+};
+
+// The predicted paths of one function: size path IDs in increasing order
+// and their scores.
+struct FunctionPredictions {
+  const char* name;
+  size_t nameLength;
+  const PathID* ids;
+  const double* scores;
+  size_t size;
+
+  // Score of path id, or NULL if it has no prediction
+  const double* find(PathID id) const;
+};
+
+// Static path predictions of a module, by function name. Binary files are
+// memory mapped; the CSV written by the classification scripts
+// ("function path,score" lines under a header) is parsed into the same
+// flat arrays. Function names are found through an open addressing hash
+// table.
+class PathPredictions {
+public:
+  PathPredictions();
+  ~PathPredictions();
+
+  // Loads fname, binary or CSV. On failure returns false and says why in
+  // error.
+  bool load(const std::string& fname, std::string& error);
+
+  unsigned getNumberOfFunctions() const { return _functions.size(); }
+  uint64_t getNumberOfPredictions() const { return _nPredictions; }
+  const FunctionPredictions& getFunction(unsigned i) const {
+    return _functions[i];
+  }
+
+  // Predictions of the function called name, or NULL if there are none
+  const FunctionPredictions* find(const char* name, size_t length) const;
+  const FunctionPredictions* find(const std::string& name) const {
+    return find(name.data(), name.size());
+  }
+
+  // Writes the predictions as a binary file
+  bool writeBinary(const std::string& fname) const;
+
+private:
+  std::vector<FunctionPredictions> _functions;
+  uint64_t _nPredictions;
+  // Index + 1 into _functions of each hash slot, 0 if empty
+  std::vector<uint32_t> _slots;
+
+  // Mapped binary file
+  void* _mapping;
+  size_t _mappingSize;
+
+  // Owned data, for CSV files and for binary files on big endian hosts
+  std::vector<PathID> _ids;
+  std::vector<double> _scores;
+  std::string _names;
+
+  bool loadBinary(const char* data, size_t size, std::string& error);
+  bool loadCSV(const char* data, size_t size, std::string& error);
+  void unmap();
+  void buildIndex();
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef PATHREGIONS_H
+#define PATHREGIONS_H
+
+#include "FlatPathDag.h"
+#include "PathCounts.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// ---------------------------------------------------------------------------
+// PathRegions cuts a FlatPathDag at the nodes that every root->exit path
+// goes through. Between two such nodes lies a single entry, single exit
+// region, and a path of the function is one path of every region in turn,
+// so the function has the product of the region path counts while the
+// regions together only have their sum.
+//
+// Neighbouring regions are merged as long as the merged region has at most
+// maxPaths paths, so straight line code does not end up as one region per
+// block. Each region is a FlatPathDag of its own whose exit node is the
+// first node of the next region; its paths leave that node out, so the
+// blocks of a function path are split among the regions without overlap.
+// ---------------------------------------------------------------------------
+class PathRegions {
+public:
+  PathRegions(const FlatPathDag& dag, PathID maxPaths);
+
+  unsigned getNumberOfRegions() const { return _regions.size(); }
+  const FlatPathDag& getRegion(unsigned r) const { return *_regions[r]; }
+
+  // Sum of the region path counts.
+  PathID getNumberOfPaths() const;
+
+  // Maps the counts of executed function paths onto the paths of every
+  // region. Returns no counts at all if the function paths could not be
+  // numbered.
+  std::vector<PathCounts> getRegionCounts(const PathCounts& counts) const;
+
+private:
+  const FlatPathDag& _dag;
+  std::vector<unsigned> _ends;        // per region, its exit node in _dag
+  std::vector<PathID> _localWeight;   // per edge of _dag, weight in its region
+  std::vector<std::unique_ptr<FlatPathDag> > _regions;
+};
+
+// Name region r of function fnName goes by in the output, "fnName.r<r>".
+std::string getRegionName(const std::string& fnName, unsigned r);
+
+#endif
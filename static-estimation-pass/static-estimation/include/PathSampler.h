@@ -0,0 +1,44 @@
+#ifndef PATHSAMPLER_H
+#define PATHSAMPLER_H
+
+#include "FlatPathDag.h"
+
+#include <string>
+#include <vector>
+
+// How the paths that never ran are picked as negative examples.
+enum SampleMode {
+  SampleStride,    // every (nPaths / budget)-th path number, as before
+  SampleUniform,   // uniformly random path numbers
+  SampleReservoir, // uniformly random, reservoir sampled while enumerating
+  SampleLength,    // the budget is split evenly across path lengths
+  SampleBranch     // the budget is split evenly across the first branch
+};
+
+// Picks up to budget path numbers of dag that are not in the sorted list
+// exclude. The result is sorted and only depends on the arguments.
+std::vector<PathID> samplePaths(const FlatPathDag& dag, SampleMode mode,
+                                unsigned budget,
+                                const std::vector<PathID>& exclude,
+                                unsigned long long seed);
+
+// Picks k distinct path numbers uniformly at random from [first, last),
+// leaving out the sorted numbers in exclude. The result is sorted. The
+// same seed always gives the same sample.
+std::vector<PathID> samplePathNumbers(PathID first, PathID last, unsigned k,
+                                      const std::vector<PathID>& exclude,
+                                      unsigned long long seed);
+
+// Splits budget across buckets that can take at most caps[i] each, as
+// evenly as the caps allow. Whatever a small bucket cannot take goes to the
+// others; the remainder of an uneven split goes to the first buckets.
+std::vector<unsigned> allocateBudget(unsigned budget,
+                                     const std::vector<unsigned>& caps);
+
+// Seed for the sample of one function, derived from its name and the
+// module wide seed so that it does not depend on the order or the thread
+// functions are processed in.
+unsigned long long getFunctionSeed(const std::string& name,
+                                   unsigned long long seed);
+
+#endif
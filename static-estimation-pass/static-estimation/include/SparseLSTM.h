@@ -0,0 +1,91 @@
+#ifndef SPARSELSTM_H
+#define SPARSELSTM_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "PathID.h"
+
+// ---------------------------------------------------------------------------
+// Sparse LSTM feature files. Only the nonzero opcode counts of each block
+// are stored, as LEB128 varints (7 bits per byte, low bits first):
+//
+//   "LSTMSPRS" version width opcode*width       file header
+//   'U' length name                             later paths belong to name
+//   'P' path count nBlocks block*nBlocks        one path
+//
+// where a block is its number of nonzero columns followed by a (gap, count)
+// pair for each of them, in column order. gap is the number of zero columns
+// skipped since the previous nonzero one (or since column 0). The opcodes
+// of the header give the LLVM opcode of each column, like "# opcodes" does
+// for the text files.
+// ---------------------------------------------------------------------------
+
+#define SPARSE_LSTM_MAGIC "LSTMSPRS"
+#define SPARSE_LSTM_VERSION 1
+
+#define SPARSE_RECORD_UNIT 'U'
+#define SPARSE_RECORD_PATH 'P'
+
+void appendVarint(std::string& out, uint64_t value);
+
+void appendSparseHeader(std::string& out, const std::vector<unsigned>& opcodes);
+void appendSparseUnit(std::string& out, const std::string& name);
+// Starts a path record; the nBlocks blocks have to follow
+void appendSparsePath(std::string& out, PathID pathNo, unsigned count,
+                      unsigned nBlocks);
+// The nonzero counters of row[0..width) as one block
+void appendSparseBlock(std::string& out, const unsigned* row, unsigned width);
+
+// A decoded path. Block b has the nonzero columns
+// columns[blockEnds[b-1]..blockEnds[b]) with the matching counts.
+struct SparsePath {
+    std::string unit;
+    PathID pathNo;
+    unsigned count;
+    std::vector<unsigned> blockEnds;
+    std::vector<unsigned> columns;
+    std::vector<unsigned> counts;
+
+    unsigned getNumberOfBlocks() const {
+        return blockEnds.size();
+    }
+};
+
+// Decodes a sparse file held in memory, one path at a time. The path
+// buffers are reused, so decoding does not allocate once they have grown.
+class SparseLSTMReader {
+    const unsigned char* pos;
+    const unsigned char* end;
+    std::vector<unsigned> opcodes;
+    std::string unit;
+    bool failed;
+
+    bool readVarint(uint64_t& value);
+    bool readUnsigned(unsigned& value);
+
+    public:
+        SparseLSTMReader(const char* data, size_t size);
+
+        // False if the data is not a sparse file or a record is cut short
+        bool good() const {
+            return !failed;
+        }
+
+        // LLVM opcode of each column
+        const std::vector<unsigned>& getOpcodes() const {
+            return opcodes;
+        }
+
+        // Reads the next path into path. Returns false at the end of the
+        // data, or on an error.
+        bool next(SparsePath& path);
+};
+
+// Appends path in the text format of -lstm-format=paths: a header line,
+// one line of width counts per block and an empty line.
+void appendDensePath(std::string& out, const SparsePath& path, unsigned width);
+
+#endif
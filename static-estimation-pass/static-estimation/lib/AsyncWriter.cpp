@@ -0,0 +1,155 @@
+#include "AsyncWriter.h"
+
+#include <algorithm>
+#include <cstring>
+
+AsyncWriteBuffer::AsyncWriteBuffer(size_t bufferSize, unsigned nBuffers)
+    : _bufferSize(bufferSize ? bufferSize : 1),
+      _buffers(std::max(nBuffers, 2u)), _current(0), _open(false),
+      _stopping(false), _failed(false) {
+}
+
+AsyncWriteBuffer::~AsyncWriteBuffer() {
+  close();
+}
+
+bool AsyncWriteBuffer::open(const std::string& fname,
+                            std::ios_base::openmode mode) {
+  if (is_open())
+    return false;
+
+  _file.open(fname.c_str(), mode | std::ios_base::out);
+  if (!_file.is_open())
+    return false;
+
+  // Buffers are only allocated once there is somewhere to write them
+  _free.clear();
+  for (unsigned i = 0; i < _buffers.size(); i++) {
+    _buffers[i].resize(_bufferSize);
+    if (i != 0)
+      _free.push_back(i);
+  }
+  _current = 0;
+  setp(&_buffers[0][0], &_buffers[0][0] + _bufferSize);
+
+  _stopping = false;
+  _failed = false;
+  _open = true;
+  _writer = std::thread(&AsyncWriteBuffer::writeLoop, this);
+  return true;
+}
+
+bool AsyncWriteBuffer::close() {
+  if (!is_open())
+    return true;
+
+  submit();
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _stopping = true;
+  }
+  _changed.notify_all();
+  _writer.join();
+
+  _file.close();
+  _open = false;
+  setp(NULL, NULL);
+  for (unsigned i = 0; i < _buffers.size(); i++)
+    std::vector<char>().swap(_buffers[i]);
+  return !_failed && !_file.fail();
+}
+
+void AsyncWriteBuffer::submit() {
+  size_t size = pptr() - pbase();
+  if (size == 0)
+    return;
+
+  std::unique_lock<std::mutex> guard(_lock);
+  Block block = { _current, size };
+  _pending.push_back(block);
+  _changed.notify_all();
+
+  // Back-pressure: wait for the writer to give a buffer back
+  _changed.wait(guard, [&]() { return !_free.empty(); });
+  _current = _free.back();
+  _free.pop_back();
+  setp(&_buffers[_current][0], &_buffers[_current][0] + _bufferSize);
+}
+
+void AsyncWriteBuffer::writeLoop() {
+  std::unique_lock<std::mutex> guard(_lock);
+  while (1) {
+    _changed.wait(guard, [&]() { return !_pending.empty() || _stopping; });
+    if (_pending.empty())
+      break;
+
+    Block block = _pending.front();
+    _pending.pop_front();
+
+    // The buffer is ours until it is back on the free list
+    guard.unlock();
+    _file.write(&_buffers[block.buffer][0], block.size);
+    bool failed = _file.fail();
+    guard.lock();
+
+    _failed = _failed || failed;
+    _free.push_back(block.buffer);
+    _changed.notify_all();
+  }
+}
+
+AsyncWriteBuffer::int_type AsyncWriteBuffer::overflow(int_type c) {
+  if (!is_open())
+    return traits_type::eof();
+
+  submit();
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize AsyncWriteBuffer::xsputn(const char* s, std::streamsize n) {
+  if (!is_open())
+    return 0;
+
+  std::streamsize written = 0;
+  while (written < n) {
+    if (pptr() == epptr())
+      submit();
+    std::streamsize room = epptr() - pptr();
+    std::streamsize chunk = std::min(room, n - written);
+    memcpy(pptr(), s + written, chunk);
+    pbump(chunk);
+    written += chunk;
+  }
+  return written;
+}
+
+int AsyncWriteBuffer::sync() {
+  if (!is_open())
+    return -1;
+
+  submit();
+  std::lock_guard<std::mutex> guard(_lock);
+  return _failed ? -1 : 0;
+}
+
+AsyncOutputFile::AsyncOutputFile(size_t bufferSize, unsigned nBuffers)
+    : std::ostream(NULL), _buffer(bufferSize, nBuffers) {
+  rdbuf(&_buffer);
+}
+
+void AsyncOutputFile::open(const std::string& fname,
+                           std::ios_base::openmode mode) {
+  if (_buffer.open(fname, mode))
+    clear();
+  else
+    setstate(std::ios_base::failbit);
+}
+
+void AsyncOutputFile::close() {
+  if (!_buffer.close())
+    setstate(std::ios_base::failbit);
+}
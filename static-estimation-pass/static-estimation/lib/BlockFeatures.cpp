@@ -0,0 +1,93 @@
+#include "BlockFeatures.h"
+#include "OpStatCounter.h"
+
+#include <cstring>
+#include <string>
+
+BlockFeatures::BlockFeatures() {
+    memset(this, 0, sizeof(*this));
+}
+
+BlockFeatures::BlockFeatures(BasicBlock* BB, const OpcodeVocabulary* vocab,
+                             unsigned* opcodeRow) {
+    memset(this, 0, sizeof(*this));
+    n_blocks = 1;
+
+    unsigned width = 0;
+    if (vocab) {
+        memset(opcodeRow, 0, OPCODE_ROW_WIDTH * sizeof(unsigned));
+        width = vocab->getWidth();
+    }
+
+    for (BasicBlock::iterator i = BB->begin(), e = BB->end(); i != e; ++i) {
+        Instruction* inst = &*i;
+        OpStatCounter::count_instruction(inst, *this);
+
+        if (vocab) {
+            unsigned column = vocab->getColumn(inst->getOpcode());
+            if (column < width)
+                opcodeRow[column]++;
+        }
+    }
+
+    std::string name = BB->getName();
+    // Check for catch blocks
+    if (name.find("dispatch") == std::string::npos && name.find("catch") != std::string::npos) {
+        n_catches++;
+    }
+    // Look for try blocks, but DON'T look for entry
+    if (name.find("try") == 0) {
+        n_tries++;
+    }
+}
+
+// Every member is an unsigned counter, so the struct adds up like an array
+BlockFeatures& BlockFeatures::operator+=(const BlockFeatures& other) {
+    unsigned* dst = reinterpret_cast<unsigned*>(this);
+    const unsigned* src = reinterpret_cast<const unsigned*>(&other);
+    for (unsigned i = 0; i < sizeof(*this) / sizeof(unsigned); i++)
+        dst[i] += src[i];
+    return *this;
+}
+
+BlockFeatures& BlockFeatures::operator-=(const BlockFeatures& other) {
+    unsigned* dst = reinterpret_cast<unsigned*>(this);
+    const unsigned* src = reinterpret_cast<const unsigned*>(&other);
+    for (unsigned i = 0; i < sizeof(*this) / sizeof(unsigned); i++)
+        dst[i] -= src[i];
+    return *this;
+}
+
+BlockFeatureTable::BlockFeatureTable(Function& F) : opcodeWidth(0) {
+    build(F, NULL);
+}
+
+BlockFeatureTable::BlockFeatureTable(Function& F,
+                                     const OpcodeVocabulary& vocab) :
+    opcodes(F.size()), opcodeWidth(vocab.getWidth()) {
+    build(F, &vocab);
+}
+
+// Without a vocabulary no opcode row is allocated or counted
+void BlockFeatureTable::build(Function& F, const OpcodeVocabulary* vocab) {
+    blocks.reserve(F.size());
+    for (Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb) {
+        BasicBlock* BB = &*bb;
+        unsigned row = blocks.size();
+        index[BB] = row;
+        blocks.push_back(BlockFeatures(BB, vocab,
+                                       vocab ? opcodes.getRow(row) : NULL));
+    }
+}
+
+const BlockFeatures& BlockFeatureTable::getFeatures(BasicBlock* BB) const {
+    return blocks[index.find(BB)->second];
+}
+
+unsigned BlockFeatureTable::getIndex(BasicBlock* BB) const {
+    return index.find(BB)->second;
+}
+
+const unsigned* BlockFeatureTable::getOpcodes(BasicBlock* BB) const {
+    return opcodes.getRow(index.find(BB)->second);
+}
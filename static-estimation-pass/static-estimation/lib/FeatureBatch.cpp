@@ -0,0 +1,63 @@
+#include "FeatureBatch.h"
+
+FeatureBatch::FeatureBatch(const BlockFeatureTable& blockTable) :
+    features(blockTable), following(NULL),
+    layout(RowMajor), matrix(NULL), stride(NUM_FEATURES) {
+}
+
+void FeatureBatch::setMatrix(MatrixLayout matrixLayout, float* values,
+                             size_t valueStride) {
+    layout = matrixLayout;
+    matrix = values;
+    stride = valueStride;
+}
+
+void FeatureBatch::storeRow(unsigned row) {
+    features.extractFeatures();
+    const float* values = features.getFeatures();
+    if (layout == RowMajor) {
+        float* dst = matrix + row * stride;
+        for (unsigned f = 0; f < NUM_FEATURES; f++)
+            dst[f] = values[f];
+    }
+    else {
+        float* dst = matrix + row;
+        for (unsigned f = 0; f < NUM_FEATURES; f++)
+            dst[f * stride] = values[f];
+    }
+}
+
+void FeatureBatch::fillRow(unsigned row, ArrayRef<BasicBlock*> path) {
+    following = NULL;
+    features.setPath(path);
+    storeRow(row);
+}
+
+void FeatureBatch::fill(const FlatPathDag& dag, ArrayRef<PathID> ids) {
+    PathDecoder decoder(dag);
+    for (unsigned row = 0; row < ids.size(); row++)
+        fillRow(row, decoder.decode(ids[row]));
+}
+
+unsigned FeatureBatch::fill(PathEnumerator& paths, unsigned maxRows,
+                            PathID* ids) {
+    unsigned row = 0;
+    while (row < maxRows && paths.next()) {
+        const std::vector<BasicBlock*>& path = paths.getPath();
+        if (following != &paths) {
+            features.setPath(path);
+            following = &paths;
+        }
+        else {
+            while (features.getPathLength() > paths.getSharedPrefix())
+                features.popBlock();
+            for (unsigned b = features.getPathLength(); b < path.size(); b++)
+                features.pushBlock(path[b]);
+        }
+
+        ids[row] = paths.getPathNumber();
+        storeRow(row);
+        row++;
+    }
+    return row;
+}
@@ -1,143 +1,172 @@
 #include "FeatureExtractor.h"
 #include "OpStatCounter.h"
+#include "NumberFormat.h"
 
-// I don't actually know this value so I'm choosing an arbitrary value
-#define MAX_OPCODE 100
+#include <algorithm>
 
-FeatureExtractor::FeatureExtractor(std::vector<BasicBlock*> path) {
-    int n_basicblocks = 0;
-    BBPath = path;
+// Indexed by FeatureID
+static const char* const FeatureNames[NUM_FEATURES] = {
+    "n_avg_args_per_call",
+    "n_basicblocks",
+    "n_catches",
+    "n_function_calls",
+    "n_globals",
+    "n_locals",
+    "n_tries",
+    "percent_alloca",
+    "percent_branchops",
+    "percent_compares",
+    "percent_equality_checks",
+    "percent_floatops",
+    "percent_intops",
+    "percent_loads",
+    "percent_memops",
+    "percent_otherops",
+    "percent_relational_checks",
+    "percent_stores",
+    "total_instructions"
+};
+
+FeatureExtractor::FeatureExtractor(ArrayRef<BasicBlock*> path) {
+    BBPath.assign(path.begin(), path.end());
+    table = NULL;
     for (auto bb : path) {
-        for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i) {
-            InstPath.push_back(&*i);
-        }
-        n_basicblocks++;
+        counts += BlockFeatures(bb);
     }
-    features.insert(featurepair("n_basicblocks", n_basicblocks));
+    std::fill(features, features + NUM_FEATURES, 0.0f);
+    features[F_N_BASICBLOCKS] = counts.n_blocks;
     return;
 }
 
-void FeatureExtractor::countHighLevelFeatures() {
-    features.insert(featurepair("total_instructions", InstPath.size()));
+// Same features, but each block is counted once per function rather than
+// once per path it is on
+FeatureExtractor::FeatureExtractor(ArrayRef<BasicBlock*> path,
+                                   const BlockFeatureTable& blockTable) {
+    table = &blockTable;
+    std::fill(features, features + NUM_FEATURES, 0.0f);
+    setPath(path);
+}
+
+FeatureExtractor::FeatureExtractor(const BlockFeatureTable& blockTable) {
+    table = &blockTable;
+    std::fill(features, features + NUM_FEATURES, 0.0f);
 }
 
-// For a given BB, create a map of (opcode -> # of times for this opcode)
-instvector FeatureExtractor::getBlockInstVec(BasicBlock* BB) {
-    instvector bbVector;
-    for (BasicBlock::iterator i = BB->begin(), e = BB->end(); i != e; ++i) {
-        Instruction* inst = &*i;
-        bbVector[inst->getOpcode()]++;
+void FeatureExtractor::setPath(ArrayRef<BasicBlock*> path) {
+    BBPath.assign(path.begin(), path.end());
+    counts = BlockFeatures();
+    for (auto bb : path) {
+        counts += table->getFeatures(bb);
     }
-    return bbVector;
+    features[F_N_BASICBLOCKS] = counts.n_blocks;
+}
+
+const char* FeatureExtractor::getFeatureName(unsigned id) {
+    return FeatureNames[id];
+}
+
+void FeatureExtractor::pushBlock(BasicBlock* BB) {
+    BBPath.push_back(BB);
+    counts += table->getFeatures(BB);
+}
+
+void FeatureExtractor::popBlock() {
+    counts -= table->getFeatures(BBPath.back());
+    BBPath.pop_back();
+}
+
+void FeatureExtractor::countHighLevelFeatures() {
+    features[F_TOTAL_INSTRUCTIONS] = counts.n_instructions;
 }
 
 // Extract fixed length features for each basic block, one BB on each line
 // The features correspond to how many times each opcode was found in the BB
 std::string FeatureExtractor::getFeaturesLSTM() {
-    std::ostringstream line;
-    for (auto bb : BBPath) {
-        std::string sep = "";
-        instvector bbVector = FeatureExtractor::getBlockInstVec(bb);
-        for (int i=0; i<MAX_OPCODE; i++) {
-            unsigned n_count = 0;
-            if (bbVector.find(i) != bbVector.end())
-                n_count = bbVector[i];
-
-            line << sep << n_count;
-            sep = ",";
+    std::string lines;
+    appendFeaturesLSTM(lines);
+    return lines;
+}
+
+void FeatureExtractor::appendFeaturesLSTM(std::string& lines) {
+    if (table) {
+        for (auto bb : BBPath)
+            writeOpcodeRow(lines, table->getOpcodes(bb), table->getOpcodeWidth());
+    }
+    else {
+        OpcodeVocabulary vocab;
+        OpcodeRows scratch(1);
+        for (auto bb : BBPath) {
+            countOpcodes(bb, vocab, scratch.getRow(0));
+            writeOpcodeRow(lines, scratch.getRow(0), vocab.getWidth());
         }
-        line << "\n";
     }
-    line << "\n";
-    return line.str();
+    lines += "\n";
 }
 
 std::string FeatureExtractor::getFeaturesCSVNames() {
-    std::ostringstream csvLine;
-    std::string sep = "";
-    for (auto i = features.begin(), e = features.end(); i != e; ++i) {
-        csvLine << sep << i->first;
-        sep = ",";
+    std::string csvLine;
+    for (unsigned i = 0; i < NUM_FEATURES; i++) {
+        if (i > 0)
+            csvLine += ',';
+        csvLine += FeatureNames[i];
     }
-    csvLine << "\n";
-    return csvLine.str();
+    csvLine += '\n';
+    return csvLine;
 }
 
 std::string FeatureExtractor::getFeaturesCSV() {
-    std::ostringstream csvLine;
-    std::string sep = "";
-    for (auto i = features.begin(), e = features.end(); i != e; ++i) {
-        csvLine << sep << std::setw(4) << i->second;
-        sep = ",";
+    std::string csvLine;
+    appendFeaturesCSV(csvLine);
+    return csvLine;
+}
+
+void FeatureExtractor::appendFeaturesCSV(std::string& csvLine) {
+    appendCSV(csvLine, features);
+}
+
+// "%4g" is what an ostream prints for a float with setw(4)
+void FeatureExtractor::appendCSV(std::string& csvLine, const float* values) {
+    char line[NUM_FEATURES * (MAX_FEATURE_CHARS + 1)];
+    char* p = line;
+    for (unsigned i = 0; i < NUM_FEATURES; i++) {
+        if (i > 0)
+            *p++ = ',';
+        p = writeFeature(p, values[i]);
     }
-    csvLine << "\n";
-    return csvLine.str();
+    *p++ = '\n';
+    csvLine.append(line, p);
 }
 
 void FeatureExtractor::countInstructionTypes() {
-    OpStatCounter* counter = new OpStatCounter(InstPath);
-    featuremap opmap = counter->get_opstats();
-    // Merge maps
-    features.insert(opmap.begin(), opmap.end());
-    delete counter;
+    OpStatCounter counter(counts);
+    counter.get_opstats(features);
 }
 
 void FeatureExtractor::countLocalGlobalVars() {
-    int n_locals = 0;
-    int n_globals = 0;
-    for (auto inst: InstPath) {
-        if (isa<LoadInst>(inst)) {
-            Value* operand = inst->getOperand(0);
-            if (isa<GlobalVariable>(operand)) {
-                n_globals++;
-            }
-            else {
-                n_locals++;
-            }
-        }
-    }
-    features.insert(featurepair("n_globals", n_globals));
-    features.insert(featurepair("n_locals", n_locals));
+    features[F_N_GLOBALS] = counts.n_globals;
+    features[F_N_LOCALS] = counts.n_locals;
 }
 
 void FeatureExtractor::countTryCatch() {
-    int n_tries = 0;
-    int n_catches = 0;
-    for (auto bb : BBPath) {
-        std::string name = bb->getName();
-        // Check for catch blocks
-        if (name.find("dispatch") == std::string::npos && name.find("catch") != std::string::npos) {
-            n_catches++;
-        }
-        // Look for try blocks, but DON'T look for entry
-        if (name.find("try") == 0) {
-            n_tries++;
-        }
-    }
-    features.insert(featurepair("n_tries", n_tries));
-    features.insert(featurepair("n_catches", n_catches));
+    features[F_N_TRIES] = counts.n_tries;
+    features[F_N_CATCHES] = counts.n_catches;
 }
 
 void FeatureExtractor::countCallInfo() {
-    int n_function_calls = 0;
-    int n_params = 0;
-    for (auto inst : InstPath) {
-        if (CallInst *callInst = dyn_cast<CallInst>(inst)) {
-            n_function_calls++;
-            n_params += callInst->getNumArgOperands();
-        }
-    }
-    features.insert(featurepair("n_function_calls", n_function_calls));
+    features[F_N_FUNCTION_CALLS] = counts.n_function_calls;
  
     float avg_args;
-    if (n_function_calls > 0)
-        avg_args = n_params/float(n_function_calls);
+    if (counts.n_function_calls > 0)
+        avg_args = counts.n_params/float(counts.n_function_calls);
     else
         avg_args = 0;
-    features.insert(featurepair("n_avg_args_per_call", avg_args));
+    features[F_N_AVG_ARGS_PER_CALL] = avg_args;
 }
 
+// Computes the features of the path as it is now. The ratios are only
+// worked out here, so a path can change block by block in between.
 void FeatureExtractor::extractFeatures() {
+    features[F_N_BASICBLOCKS] = counts.n_blocks;
     countHighLevelFeatures();
     countInstructionTypes();
     countTryCatch();
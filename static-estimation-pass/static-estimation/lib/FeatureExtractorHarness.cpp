@@ -23,8 +23,9 @@ namespace {
       FeatureExtractor* features = new FeatureExtractor(BBVector);
       features->extractFeatures();
       errs() << "I saw a function called " << F.getName() << "!\n";
-      for (auto inst : features->getFeatures()) {
-        errs() << inst.first << " -> " << format("%.3f", inst.second) << "\n";
+      const float* values = features->getFeatures();
+      for (unsigned i = 0; i < NUM_FEATURES; i++) {
+        errs() << FeatureExtractor::getFeatureName(i) << " -> " << format("%.3f", values[i]) << "\n";
       }
       errs() << features->getFeaturesCSV();
       delete features;
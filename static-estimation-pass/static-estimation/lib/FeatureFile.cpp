@@ -0,0 +1,123 @@
+#include "FeatureFile.h"
+#include "FeatureExtractor.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define FEATURE_FILE_VERSION 1
+#define SECTION_ALIGN 64
+
+namespace {
+  bool isLittleEndian() {
+    const uint16_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1;
+  }
+
+  // Reverses the bytes of a value on big endian hosts
+  void toLittleEndian(void* value, size_t size) {
+    if (!isLittleEndian()) {
+      char* p = static_cast<char*>(value);
+      std::reverse(p, p + size);
+    }
+  }
+
+  uint64_t alignSection(uint64_t offset) {
+    return (offset + SECTION_ALIGN - 1) & ~uint64_t(SECTION_ALIGN - 1);
+  }
+
+  void appendName(std::vector<char>& names, const std::string& name) {
+    uint32_t length = name.size();
+    names.insert(names.end(), reinterpret_cast<const char*>(&length),
+                 reinterpret_cast<const char*>(&length) + sizeof(length));
+    names.insert(names.end(), name.begin(), name.end());
+  }
+}
+
+FeatureFileWriter::FeatureFileWriter(const std::string& fname,
+                                     const std::vector<std::string>& unitNames,
+                                     uint64_t nRows)
+    : _file(fname.c_str(), std::ofstream::out | std::ofstream::binary |
+                           std::ofstream::trunc) {
+  // Lengths are byte swapped with the rest of the names section below
+  std::vector<char> names;
+  for (unsigned f = 0; f < NUM_FEATURES; f++)
+    appendName(names, FeatureExtractor::getFeatureName((FeatureID)f));
+  for (unsigned u = 0; u < unitNames.size(); u++)
+    appendName(names, unitNames[u]);
+
+  memset(&_header, 0, sizeof(_header));
+  memcpy(_header.magic, "PATHFEAT", sizeof(_header.magic));
+  _header.version = FEATURE_FILE_VERSION;
+  _header.nFeatures = NUM_FEATURES;
+  _header.nRows = nRows;
+  _header.nUnits = unitNames.size();
+  _header.namesOffset = alignSection(sizeof(FeatureFileHeader));
+  _header.unitOffset = alignSection(_header.namesOffset + names.size());
+  _header.pathOffset = alignSection(_header.unitOffset + nRows * sizeof(uint32_t));
+  _header.countOffset = alignSection(_header.pathOffset + nRows * sizeof(uint64_t));
+  _header.featureOffset = alignSection(_header.countOffset + nRows * sizeof(uint32_t));
+
+  std::lock_guard<std::mutex> guard(_lock);
+  FeatureFileHeader header = _header;
+  toLittleEndian(&header.version, sizeof(header.version));
+  toLittleEndian(&header.nFeatures, sizeof(header.nFeatures));
+  toLittleEndian(&header.nRows, sizeof(header.nRows));
+  toLittleEndian(&header.nUnits, sizeof(header.nUnits));
+  for (uint64_t* offset = &header.namesOffset; offset <= &header.featureOffset; offset++)
+    toLittleEndian(offset, sizeof(*offset));
+  for (size_t n = 0; n < names.size(); ) {
+    uint32_t length;
+    memcpy(&length, &names[n], sizeof(length));
+    toLittleEndian(&names[n], sizeof(length));
+    n += sizeof(length) + length;
+  }
+  _file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!names.empty())
+    writeAt(_header.namesOffset, &names[0], 1, names.size());
+
+  // Make the file full length even if some rows are never written
+  uint64_t end = _header.featureOffset + NUM_FEATURES * nRows * sizeof(float);
+  if (end > _header.namesOffset + names.size()) {
+    _file.seekp(end - 1);
+    _file.put(0);
+  }
+}
+
+void FeatureFileWriter::writeAt(uint64_t offset, const void* values,
+                                size_t size, size_t n) {
+  const char* data = static_cast<const char*>(values);
+  if (size > 1 && !isLittleEndian()) {
+    _scratch.assign(data, data + size * n);
+    for (size_t i = 0; i < n; i++)
+      std::reverse(&_scratch[i * size], &_scratch[i * size] + size);
+    data = &_scratch[0];
+  }
+  _file.seekp(offset);
+  _file.write(data, size * n);
+}
+
+void FeatureFileWriter::writeRows(uint64_t firstRow, unsigned nRows,
+                                  unsigned unit, const PathID* paths,
+                                  const unsigned* counts,
+                                  const float* features, size_t stride) {
+  if (nRows == 0)
+    return;
+
+  // The columns are widened to their on-disk types outside the lock
+  std::vector<uint32_t> units(nRows, unit);
+  std::vector<uint32_t> rowCounts(counts, counts + nRows);
+  std::vector<uint64_t> rowPaths(paths, paths + nRows);
+
+  std::lock_guard<std::mutex> guard(_lock);
+  writeAt(_header.unitOffset + firstRow * sizeof(uint32_t),
+          &units[0], sizeof(uint32_t), nRows);
+  writeAt(_header.pathOffset + firstRow * sizeof(uint64_t),
+          &rowPaths[0], sizeof(uint64_t), nRows);
+  writeAt(_header.countOffset + firstRow * sizeof(uint32_t),
+          &rowCounts[0], sizeof(uint32_t), nRows);
+  for (unsigned f = 0; f < NUM_FEATURES; f++) {
+    uint64_t column = _header.featureOffset + f * _header.nRows * sizeof(float);
+    writeAt(column + firstRow * sizeof(float),
+            features + f * stride, sizeof(float), nRows);
+  }
+}
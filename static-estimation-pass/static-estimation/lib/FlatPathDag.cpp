@@ -0,0 +1,176 @@
+#include "FlatPathDag.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <utility>
+
+// Returns true if the edge is one that calculatePathNumbers assigned a weight.
+bool FlatPathDag::isNumberedEdge(BallLarusEdge* edge) {
+  return(edge->getType() != BallLarusEdge::BACKEDGE &&
+         edge->getType() != BallLarusEdge::SPLITEDGE);
+}
+
+// Adds b to a, or returns false if the sum does not fit in a PathID.
+static bool addPaths(PathID& a, PathID b) {
+  if(b > ~PathID(0) - a)
+    return(false);
+  a += b;
+  return(true);
+}
+
+// The block the back or split edge comes from, if edge is the phony edge
+// out of root that stands for it.
+static BasicBlock* realSource(BallLarusEdge* edge, BallLarusNode* root) {
+  if((edge->getType() != BallLarusEdge::BACKEDGE_PHONY &&
+      edge->getType() != BallLarusEdge::SPLITEDGE_PHONY) ||
+     edge->getSource() != root || !edge->getRealEdge())
+    return(NULL);
+  return(edge->getRealEdge()->getSource()->getBlock());
+}
+
+// Numbers the paths like calculatePathNumbers, but in 64 bits: the weight
+// of an edge is the number of paths through the edges before it, visiting
+// the successors in the order of the BallLarusNode. The nodes that
+// calculatePathNumbers split only have their phony edge to the exit left,
+// so they count one path, as they do in LLVM. Then numbers the nodes
+// breadth first from the root and copies every edge that leads to at least
+// one path.
+FlatPathDag::FlatPathDag(BLInstrumentationDag* dag) :
+  _function(&dag->getFunction()), _exit(~0u), _overflow(false) {
+  DenseMap<BallLarusNode*, PathID> numberPaths;
+  DenseMap<BallLarusEdge*, PathID> weights;
+
+  // Depth first, so every successor is numbered before its predecessor
+  std::vector<std::pair<BallLarusNode*, BLEdgeIterator> > stack;
+  numberPaths[dag->getExit()] = 1;
+  if(dag->getRoot() != dag->getExit())
+    stack.push_back(std::make_pair(dag->getRoot(), dag->getRoot()->succBegin()));
+
+  while(!stack.empty()) {
+    BallLarusNode* node = stack.back().first;
+    BLEdgeIterator& edge = stack.back().second;
+
+    // Descend into the first successor that still needs numbering
+    for(; edge != node->succEnd(); edge++) {
+      BallLarusNode* target = (*edge)->getTarget();
+      if(isNumberedEdge(*edge) && numberPaths.find(target) == numberPaths.end())
+        break;
+    }
+    if(edge != node->succEnd()) {
+      BallLarusNode* target = (*edge)->getTarget();
+      stack.push_back(std::make_pair(target, target->succBegin()));
+      continue;
+    }
+
+    PathID sum = 0;
+    for(BLEdgeIterator succ = node->succBegin(), end = node->succEnd();
+        succ != end; succ++) {
+      if(!isNumberedEdge(*succ))
+        continue;
+      weights[*succ] = sum;
+      if(!addPaths(sum, numberPaths[(*succ)->getTarget()]))
+        _overflow = true;
+    }
+    numberPaths[node] = sum;
+    stack.pop_back();
+  }
+
+  DenseMap<BallLarusNode*, unsigned> index;
+  std::vector<BallLarusNode*> nodes;
+  std::vector<std::pair<PathID, BallLarusEdge*> > succs;
+
+  index[dag->getRoot()] = 0;
+  nodes.push_back(dag->getRoot());
+
+  for(unsigned n = 0; n < nodes.size(); n++) {
+    BallLarusNode* node = nodes[n];
+    _edgeBegin.push_back(_edgeTarget.size());
+
+    // The exit node only has the exit->root edge
+    if(node == dag->getExit()) {
+      _exit = n;
+      continue;
+    }
+
+    succs.clear();
+    for(BLEdgeIterator edge = node->succBegin(), end = node->succEnd();
+        edge != end; edge++) {
+      BallLarusNode* target = (*edge)->getTarget();
+      if(!isNumberedEdge(*edge))
+        continue;
+      if(numberPaths[target] == 0)
+        continue;
+      succs.push_back(std::make_pair(weights[*edge], *edge));
+    }
+    std::stable_sort(succs.begin(), succs.end(),
+                     [](const std::pair<PathID, BallLarusEdge*>& a,
+                        const std::pair<PathID, BallLarusEdge*>& b) {
+                       return a.first < b.first;
+                     });
+
+    for(unsigned i = 0; i < succs.size(); i++) {
+      BallLarusEdge* edge = succs[i].second;
+      BallLarusNode* target = edge->getTarget();
+      if(index.find(target) == index.end()) {
+        unsigned number = nodes.size();
+        index[target] = number;
+        nodes.push_back(target);
+      }
+      _edgeTarget.push_back(index[target]);
+      _edgeWeight.push_back(succs[i].first);
+      _edgeType.push_back(edge->getType());
+      _edgeRealSource.push_back(realSource(edge, dag->getRoot()));
+    }
+  }
+  _edgeBegin.push_back(_edgeTarget.size());
+
+  for(unsigned n = 0; n < nodes.size(); n++) {
+    _blocks.push_back(nodes[n]->getBlock());
+    _numberPaths.push_back(numberPaths[nodes[n]]);
+  }
+}
+
+// The nodes are already in topological order, so numbering them backwards
+// sees every successor before its predecessors.
+FlatPathDag::FlatPathDag(const FlatPathDag& dag,
+                         const std::vector<unsigned>& nodes) :
+  _function(dag.getFunction()), _exit(nodes.size() - 1), _overflow(false) {
+  DenseMap<unsigned, unsigned> index;
+  for(unsigned n = 0; n < nodes.size(); n++)
+    index[nodes[n]] = n;
+
+  for(unsigned n = 0; n < nodes.size(); n++) {
+    _edgeBegin.push_back(_edgeTarget.size());
+    _blocks.push_back(dag.getBlock(nodes[n]));
+    if(n == _exit)
+      continue;
+
+    for(unsigned edge = dag.succBegin(nodes[n]); edge != dag.succEnd(nodes[n]);
+        edge++) {
+      _edgeTarget.push_back(index[dag.getTarget(edge)]);
+      _edgeWeight.push_back(0);
+      _edgeType.push_back(dag.getType(edge));
+      _edgeRealSource.push_back(dag.getRealSource(edge));
+    }
+  }
+  _edgeBegin.push_back(_edgeTarget.size());
+
+  _numberPaths.resize(nodes.size(), 0);
+  _numberPaths[_exit] = 1;
+  for(unsigned n = _exit; n-- > 0; ) {
+    PathID sum = 0;
+    for(unsigned edge = succBegin(n); edge != succEnd(n); edge++) {
+      _edgeWeight[edge] = sum;
+      if(!addPaths(sum, _numberPaths[_edgeTarget[edge]]))
+        _overflow = true;
+    }
+    _numberPaths[n] = sum;
+  }
+}
+
+FlatPathDag* buildFlatPathDag(Function& F) {
+  BLInstrumentationDag dag(F);
+  dag.init();
+  dag.calculatePathNumbers();
+  return(new FlatPathDag(&dag));
+}
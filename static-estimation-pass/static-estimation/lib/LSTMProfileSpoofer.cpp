@@ -5,11 +5,14 @@
 #include "ProfilingUtils.h"
 #include "llvm/Analysis/PathNumbering.h"
 #include "llvm/Analysis/PathProfileInfo.h"
+#include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/TypeBuilder.h"
 #include "llvm/Pass.h"
@@ -22,6 +25,7 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 #include <fstream>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
@@ -35,11 +39,33 @@
 #include <set>
 
 #include "BLInstrumentation.h"
-
-#define MAX_PATHS 1000
+#include "PathEnumerator.h"
+#include "PathPredictions.h"
 
 using namespace llvm;
 
+static cl::opt<std::string> PredictionsFile("spoofer-predictions",
+    cl::desc("Static path predictions, a binary prediction file or the "
+             "CSV written by the classification scripts"),
+    cl::init("static_predictions.csv"));
+
+static cl::opt<std::string> AnnotateFile("spoofer-annotate",
+    cl::desc("Write the module, with the predicted frequencies as "
+             "branch_weights and function entry counts, to this bitcode file"),
+    cl::init(""));
+
+static cl::opt<bool> DumpProfile("spoofer-dump",
+    cl::desc("Print every prediction and every block, edge and function "
+             "count of the spoofed profile"),
+    cl::init(false));
+
+// Largest branch weight given to a successor. The weights of a terminator
+// are scaled so that their sum stays far below 2^32.
+#define BRANCH_WEIGHT_SCALE (1u << 20)
+
+// Named metadata holding a !{function, double count} node per function
+#define ENTRY_COUNTS_NAME "static.entry.counts"
+
 namespace {
   class LSTMProfileSpooferPass : public ModulePass, public ProfileInfo {
   private:
@@ -47,20 +73,24 @@ namespace {
     // with code to save the profile to disk.
     bool runOnModule(Module &M);
 
-    // Calculate the path for a single ID
-    std::vector<BasicBlock*> computePath(BLInstrumentationDag* dag, unsigned pathNo);
-
     // Calculates all paths for a dag
-    void calculatePaths(BLInstrumentationDag* dag);
+    void calculatePaths(const FlatPathDag& dag);
 
     // Analyzes the function for Ball-Larus path profiling, and inserts code.
     void runOnFunction(std::vector<Constant*> &ftInit, Function &F, Module &M);
 
-    // Path ID to Hotness
-    std::map<std::string, std::map<int, double>> hotness;
+    // Writes the predicted edge frequencies of F as branch_weights on its
+    // branches, switches and indirect branches
+    void annotateFunction(Function &F);
+
+    // Annotates every function and writes the module to AnnotateFile
+    void annotateModule(Module &M);
+
+    // Prints the predictions and the profile made from them to errs()
+    void dumpProfile();
 
-    // File for input of static profile
-    std::ifstream ifs;
+    // Path ID to Hotness, by function name
+    PathPredictions predictions;
 
   public:
     static char ID; // Pass identification, replacement for typeid
@@ -102,101 +132,68 @@ Pass *llvm::createProfileLoaderPass(const std::string &Filename) {
   return new LSTMProfileSpooferPass(Filename);
 }
 
-// Compute the path through the DAG from its path number
-std::vector<BasicBlock*> LSTMProfileSpooferPass::computePath(BLInstrumentationDag* dag, unsigned pathNo) {
-    unsigned R = pathNo;
-    std::vector<BasicBlock*> path;
-
-    BLInstrumentationNode* prev2;
-    BLInstrumentationNode* prev1;
-    //std::unordered_map<BLInstrumentationNode*,int> visited;
-
-    BLInstrumentationNode* curNode = (BLInstrumentationNode*)(dag->getRoot());
-    while (1) {
-        BLInstrumentationEdge* nextEdge;
-        unsigned bestEdge = 0;
-        // Add the basic block to the list
-
-        path.push_back(curNode->getBlock());
-  //visited[curNode] = 1;
-  //errs() << "next edge options: ";
-        
-  for (BLEdgeIterator next = curNode->succBegin(), end = curNode->succEnd(); next != end; next++) {
-            // We want the largest edge that's less than R
-            BLInstrumentationEdge* i = (BLInstrumentationEdge*) *next;
-      //errs() << i << " ";
-            unsigned weight = i->getWeight();
-            //if (weight <= R && weight >= bestEdge && visited.find((BLInstrumentationNode*)i->getTarget()) == visited.end()) 
-      if (weight <= R && weight >= bestEdge && prev1 != (BLInstrumentationNode*)i->getTarget()) {
-                bestEdge = weight;
-                nextEdge = i;
-            }
-      
-      if (R == 0 && (BLInstrumentationNode*)i->getTarget() == (BLInstrumentationNode*)dag->getExit()) {
-    //errs() << "Found exit node with R=0!\n";
-    bestEdge = weight;
-    nextEdge = i;
-    break;
-      }
-      
-        }
-  //errs() << "\n";
-  
-        BLInstrumentationNode* nextNode = (BLInstrumentationNode*)(nextEdge->getTarget());       
-
-  //errs() << "R = " << R << " nextNode: " << nextNode << " bestEdge = " << bestEdge << "\n";   
-
-  if (nextNode == (BLInstrumentationNode*)dag->getExit()) 
-    break;
-
-  // Terminate on the <null> 
-  //if (!nextNode->getBlock())
-        //  break;
-        // Move to next node
-  //prevent loops when weight = 0
-  prev2 = prev1;
-  prev1 = curNode;
-
-        curNode = nextNode;
-        R -= bestEdge;
-    }
-    return path;
-}
-// Iterate through all possible paths in the dag
-void LSTMProfileSpooferPass::calculatePaths(BLInstrumentationDag* dag) {
-  unsigned nPaths = dag->getNumberOfPaths();
+// Decode the predicted paths of the dag, in path number order
+void LSTMProfileSpooferPass::calculatePaths(const FlatPathDag& dag) {
+  PathID nPaths = dag.getNumberOfPaths();
   errs() << "There are " << nPaths << " paths\n";
+  if (dag.hasOverflow())
+    errs() << "WARNING: 2^64 paths or more, no path can be numbered!\n";
+
+  Function* fn = dag.getFunction();
+  const FunctionPredictions* predicted =
+      predictions.find(fn->getName().data(), fn->getName().size());
+  if (!predicted) {
+    errs() << "No predictions for this function\n\n";
+    return;
+  }
+  // Only made once a path matches, like the blocks and edges it counts
+  BlockCounts* blocks = NULL;
+  EdgeWeights* edges = NULL;
 
-  int stride = nPaths / MAX_PATHS;
-  if (stride <= 1)
-      stride = 1;
-
-  errs() << "Using stride " << stride << "\n";
-
-  Function* fn = dag->getRoot()->getBlock()->getParent();
-
+  // The work follows the number of predictions, not the number of paths
   int n_extracted = 0;
-  // Enumerate all paths in this function
-  for (int i=0; i<nPaths; i++) {
-      // Show progress for large values
-      if (i % 100000 == 0 && i != 0) {
-          errs() << "Computed for " << i << "/" << nPaths << " paths\n";
+  PathDecoder decoder(dag);
+  for (size_t p = 0; p < predicted->size; p++) {
+      PathID i = predicted->ids[p];
+      if (i >= nPaths) {
+          errs() << "WARNING: predicted path " << i << " is out of range\n";
+          continue;
       }
 
-      std::vector<BasicBlock*> path = computePath(dag, i);
-      // ProfilePath* curPath = PI->getPath(i);
-      // unsigned n_real_count = 0;
-      // if (curPath) {
-      //     n_real_count = curPath->getCount();
-      // }
-
-      if (hotness.find(fn->getName()) != hotness.end()) {
-          if(hotness[fn->getName()].find(i) != hotness[fn->getName()].end()){
-            for(int j = 0; j < path.size(); j++){
-              BlockInformation[fn][path[j]] += hotness[fn->getName()][i];
-            }
-          }
+      const std::vector<BasicBlock*>& path = decoder.decode(i);
+      const std::vector<unsigned>& pathEdges = decoder.getEdges();
+      double score = predicted->scores[p];
+      if (!blocks) {
+        blocks = &BlockInformation[fn];
+        edges = &EdgeInformation[fn];
       }
+
+      // A path either enters the function, or resumes after a back or
+      // split edge through a phony edge out of the root, which never runs
+      // the root block. The back or split edge is counted here, on the
+      // path that resumes from it.
+      unsigned first = 1;
+      unsigned start = pathEdges[0];
+      if (dag.getType(start) == BallLarusEdge::NORMAL) {
+        (*edges)[getEdge(0, path[0])] += score;
+        FunctionInformation[fn] += score;
+        first = 0;
+      }
+      else if (dag.getRealSource(start)) {
+        BasicBlock* resume = dag.getBlock(dag.getTarget(start));
+        (*edges)[getEdge(dag.getRealSource(start), resume)] += score;
+      }
+      for(unsigned j = first; j < path.size(); j++){
+        (*blocks)[path[j]] += score;
+        if (j + 1 < path.size())
+          (*edges)[getEdge(path[j], path[j + 1])] += score;
+      }
+
+      // It then leaves the function, unless it stops at a back or split
+      // edge through a phony edge into the exit
+      if (dag.getType(pathEdges.back()) == BallLarusEdge::NORMAL)
+        (*edges)[getEdge(path.back(), 0)] += score;
+      n_extracted++;
   }
   errs() << "Extracted " << n_extracted << " paths for this function\n\n";
 }
@@ -214,17 +211,115 @@ void LSTMProfileSpooferPass::runOnFunction(std::vector<Constant*> &ftInit,
   */    
 
 
-  // Build DAG from CFG
-  BLInstrumentationDag dag = BLInstrumentationDag(F);
-  dag.init();
-
-  // give each path a unique integer value
-  dag.calculatePathNumbers();
+  std::unique_ptr<FlatPathDag> dag(buildFlatPathDag(F));
 
   errs() << "Starting calculatePaths..." << "\n";
- 
-  // Calculate the features for each path 
-  calculatePaths(&dag);
+  calculatePaths(*dag);
+}
+
+// Successors that appear more than once, like switch cases sharing a
+// block, split the weight of their edge evenly.
+void LSTMProfileSpooferPass::annotateFunction(Function &F) {
+  std::map<const Function*, EdgeWeights>::iterator fi = EdgeInformation.find(&F);
+  if (fi == EdgeInformation.end())
+    return;
+  const EdgeWeights& edges = fi->second;
+
+  MDBuilder builder(F.getContext());
+  std::vector<double> counts;
+  std::vector<uint32_t> weights;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    TerminatorInst* term = BB->getTerminator();
+    if (!term || term->getNumSuccessors() < 2)
+      continue;
+    if (term->getOpcode() != Instruction::Br &&
+        term->getOpcode() != Instruction::Switch &&
+        term->getOpcode() != Instruction::IndirectBr)
+      continue;
+
+    std::map<const BasicBlock*, unsigned> repeats;
+    for (unsigned i = 0; i < term->getNumSuccessors(); i++)
+      repeats[term->getSuccessor(i)]++;
+
+    counts.clear();
+    double total = 0;
+    for (unsigned i = 0; i < term->getNumSuccessors(); i++) {
+      BasicBlock* succ = term->getSuccessor(i);
+      EdgeWeights::const_iterator edge = edges.find(getEdge(&*BB, succ));
+      double count = edge == edges.end() ? 0 : edge->second / repeats[succ];
+      counts.push_back(count);
+      total += count;
+    }
+    // No predicted path leaves this block
+    if (total <= 0)
+      continue;
+
+    weights.clear();
+    for (unsigned i = 0; i < counts.size(); i++)
+      weights.push_back(1 + (uint32_t)(counts[i] / total * BRANCH_WEIGHT_SCALE));
+    term->setMetadata(LLVMContext::MD_prof, builder.createBranchWeights(weights));
+  }
+}
+
+void LSTMProfileSpooferPass::annotateModule(Module &M) {
+  LLVMContext& context = M.getContext();
+  NamedMDNode* entryCounts = M.getOrInsertNamedMetadata(ENTRY_COUNTS_NAME);
+
+  unsigned nFunctions = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
+    if (F->isDeclaration())
+      continue;
+    annotateFunction(*F);
+
+    std::map<const Function*, double>::iterator count = FunctionInformation.find(&*F);
+    if (count == FunctionInformation.end())
+      continue;
+    Value* operands[] = {
+      &*F, ConstantFP::get(Type::getDoubleTy(context), count->second)
+    };
+    entryCounts->addOperand(MDNode::get(context, operands));
+    nFunctions++;
+  }
+
+  std::string errorInfo;
+  raw_fd_ostream out(AnnotateFile.c_str(), errorInfo, raw_fd_ostream::F_Binary);
+  if (!errorInfo.empty()) {
+    errs() << "WARNING: cannot write " << AnnotateFile << ": " << errorInfo << "\n";
+    return;
+  }
+  WriteBitcodeToFile(&M, out);
+  errs() << "Wrote " << AnnotateFile << " with entry counts for "
+         << nFunctions << " functions\n";
+}
+
+// One line per prediction, block count, function count and edge count
+void LSTMProfileSpooferPass::dumpProfile() {
+  for(unsigned f = 0; f < predictions.getNumberOfFunctions(); f++){
+    const FunctionPredictions& fp = predictions.getFunction(f);
+    for(size_t j = 0; j < fp.size; j++){
+      errs() << StringRef(fp.name, fp.nameLength) << ", " << fp.ids[j] << ", " << fp.scores[j] << "\n";
+    }
+  }
+
+  for(std::map<const Function*, std::map<const BasicBlock*, double>>::iterator i = BlockInformation.begin(); i != BlockInformation.end(); ++i){
+    for(std::map<const BasicBlock*, double>::iterator j = i->second.begin(); j != i->second.end(); ++j){
+      errs() << i->first->getName() << ", " << j->first->getName() << ", " << j->second << "\n";
+    }
+  }
+
+  for(std::map<const Function*, double>::iterator i = FunctionInformation.begin(); i != FunctionInformation.end(); ++i){
+    errs() << i->first->getName() << ", " << i->second << "\n";
+  }
+
+  // The entry and exit edges have no block on one side
+  for(std::map<const Function*, EdgeWeights>::iterator i = EdgeInformation.begin(); i != EdgeInformation.end(); ++i){
+    for(EdgeWeights::iterator j = i->second.begin(); j != i->second.end(); ++j){
+      errs() << i->first->getName() << ", "
+             << (j->first.first ? j->first.first->getName() : "(entry)") << " -> "
+             << (j->first.second ? j->first.second->getName() : "(exit)") << ", "
+             << j->second << "\n";
+    }
+  }
 }
 
 bool LSTMProfileSpooferPass::runOnModule(Module &M) {
@@ -234,22 +329,13 @@ bool LSTMProfileSpooferPass::runOnModule(Module &M) {
   BlockInformation.clear();
   FunctionInformation.clear();
 
-  errs() << "about to open file\n";
-  ifs.open("static_predictions.csv");
-  errs() << "tried to open file\n";
-  std::string fName;
-  int pathID;
-  double count;
-  std::string line;
-  std::getline(ifs,line);
-  while(std::getline(ifs,line)){
-    fName = line.substr(0, line.find(" "));
-    line = line.substr(line.find(" ")+1);
-    pathID = std::stoi(line.substr(0, line.find(",")));
-    count = std::stod(line.substr(line.find(",")+1));
-    hotness[fName][pathID] = count;
-  }
-  ifs.close();
+  // Binary files are mapped, CSV files parsed in one pass
+  errs() << "Reading predictions from " << PredictionsFile << "\n";
+  std::string error;
+  if (!predictions.load(PredictionsFile, error))
+    errs() << "WARNING: " << error << ", no path is predicted!\n";
+  errs() << "Read " << predictions.getNumberOfPredictions() << " predictions for "
+         << predictions.getNumberOfFunctions() << " functions\n";
 
   // No main, no instrumentation!
   Function *Main = M.getFunction("main");
@@ -271,17 +357,13 @@ bool LSTMProfileSpooferPass::runOnModule(Module &M) {
     runOnFunction(ftInit, *F, M);
   }
 
-  for(std::map<std::string, std::map<int, double>>::iterator i = hotness.begin(); i != hotness.end(); ++i){
-    for(std::map<int, double>::iterator j = i->second.begin(); j != i->second.end(); ++j){
-      errs() << i->first << ", " << j->first << ", " << j->second << "\n";
-    }
-  }
+  if (DumpProfile)
+    dumpProfile();
 
-  for(std::map<const Function*, std::map<const BasicBlock*, double>>::iterator i = BlockInformation.begin(); i != BlockInformation.end(); ++i){
-    for(std::map<const BasicBlock*, double>::iterator j = i->second.begin(); j != i->second.end(); ++j){
-      errs() << i->first->getName() << ", " << j->first->getName() << ", " << j->second << "\n";
-    }
-  }
-  return false;
+  // Only the annotating mode changes the module
+  if (AnnotateFile.empty())
+    return false;
+  annotateModule(M);
+  return true;
 }
 
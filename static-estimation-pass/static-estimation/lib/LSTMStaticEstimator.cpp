@@ -21,38 +21,141 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
+#include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <memory>
 #include <vector>
-#include <unordered_map>
 #include <string>
 
+#include "AsyncWriter.h"
 #include "BLInstrumentation.h"
+#include "BlockFeatures.h"
 #include "FeatureExtractor.h"
+#include "NumberFormat.h"
+#include "PathEnumerator.h"
+#include "PathCounts.h"
+#include "ParallelRunner.h"
+#include "PathSampler.h"
+#include "SparseLSTM.h"
+#include "PathRegions.h"
 
 #define MAX_PATHS 500
 
 using namespace llvm;
 
+enum LSTMFormat {
+  FormatPaths,
+  FormatIndexed,
+  FormatSparse
+};
+
+static cl::opt<unsigned> NumThreads("lstm-static-estimation-threads",
+    cl::desc("Number of threads extracting features (0 = one per core)"),
+    cl::init(1));
+
+static cl::opt<unsigned> ChunkSize("lstm-static-estimation-chunk",
+    cl::desc("Paths per parallel task; larger functions are split"),
+    cl::init(1 << 20));
+
+static cl::opt<SampleMode> Sampling("lstm-sample",
+    cl::desc("How paths that never ran are picked as negative examples"),
+    cl::init(SampleUniform),
+    cl::values(
+      clEnumValN(SampleStride, "stride", "Every nPaths/budget-th path number"),
+      clEnumValN(SampleUniform, "uniform", "Uniformly random path numbers"),
+      clEnumValN(SampleReservoir, "reservoir",
+                 "Uniformly random, reservoir sampled while enumerating"),
+      clEnumValN(SampleLength, "length", "Stratified by path length"),
+      clEnumValN(SampleBranch, "branch", "Stratified by the first branch"),
+      clEnumValEnd));
+
+static cl::opt<unsigned> SampleSeed("lstm-sample-seed",
+    cl::desc("Seed of the path sampler"), cl::init(0));
+
+static cl::opt<unsigned> FunctionBudget("lstm-sample-budget",
+    cl::desc("Paths that never ran to extract per function"),
+    cl::init(MAX_PATHS));
+
+static cl::opt<unsigned> ModuleBudget("lstm-sample-module-budget",
+    cl::desc("Paths that never ran to extract in the whole module, split "
+             "evenly across functions (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<bool> Regions("lstm-regions",
+    cl::desc("Extract the paths of single entry, single exit regions "
+             "instead of whole function paths"),
+    cl::init(false));
+
+static cl::opt<unsigned> RegionPaths("lstm-region-paths",
+    cl::desc("Merge neighbouring regions up to this many paths"),
+    cl::init(4096));
+
+static cl::opt<bool> CompactOpcodes("lstm-compact-opcodes",
+    cl::desc("Only give the opcodes used in the module a feature column"),
+    cl::init(false));
+
+static cl::opt<LSTMFormat> Format("lstm-format",
+    cl::desc("How the blocks of each path are written"),
+    cl::init(FormatPaths),
+    cl::values(
+      clEnumValN(FormatPaths, "paths", "The opcode histogram of every block "
+                 "of every path"),
+      clEnumValN(FormatIndexed, "indexed", "The opcode histograms of each "
+                 "function once, then each path as a list of block indices"),
+      clEnumValN(FormatSparse, "sparse", "Binary records of the nonzero "
+                 "opcode counts of each block, in feature_output.lstm"),
+      clEnumValEnd));
+
 class LSTMStaticEstimatorPass : public ModulePass {
 private:
   // Profiling
   PathProfileInfo* PI;
 
-  // File for output
-  std::ofstream ofs;
+  // File for output, written by a background thread
+  AsyncOutputFile ofs;
+
+  // Opcodes counted in the block features
+  OpcodeVocabulary vocab;
 
   // Instruments each function with path profiling.  'main' is instrumented
   // with code to save the profile to disk.
   bool runOnModule(Module &M);
 
-  // Calculate the path for a single ID
-  std::vector<BasicBlock*> computePath(BLInstrumentationDag* dag, unsigned pathNo);
-
-  // Calculates all paths for a dag
-  void calculatePaths(BLInstrumentationDag* dag);
-
-  // Analyzes the function for Ball-Larus path profiling, and inserts code.
-  void runOnFunction(std::vector<Constant*> &ftInit, Function &F, Module &M);
+  // Picks the paths to extract from a dag, a function or a region called
+  // name: every executed path plus up to budget sampled paths that never
+  // ran, sorted.
+  std::vector<PathID> selectPaths(const FlatPathDag& dag,
+                                  const PathCounts& counts,
+                                  const std::string& name, unsigned budget,
+                                  raw_ostream& log);
+
+  // Decodes and extracts the paths ids[first..last), whose blocks are
+  // counted in table, and returns how many were extracted. Safe to call
+  // from several threads at once.
+  unsigned extractPaths(const FlatPathDag& dag, const PathCounts& counts,
+                        const BlockFeatureTable& table,
+                        const std::string& name,
+                        const std::vector<PathID>& ids,
+                        PathID first, PathID last, std::ostream& out);
+
+  // Builds the path DAG of F and logs its path count.
+  FlatPathDag* buildDag(Function &F, raw_ostream& log);
+
+  // Extracts features for the paths of F.
+  void runOnFunction(Function &F, const PathCounts& counts, unsigned budget,
+                     std::ostream& out, raw_ostream& log);
+
+  // Number of paths that never ran each function (or region) may extract.
+  // With a module budget this needs every path count up front.
+  std::vector<unsigned> getBudgets(const std::vector<PathID>& nPaths,
+                                   const std::vector<const PathCounts*>& counts);
+
+  // Extracts features for all functions on nThreads threads. Functions
+  // are split into ranges of paths so that one huge function does not
+  // end up on a single thread.
+  void runParallel(const std::vector<Function*>& functions,
+                   const std::vector<PathCounts>& counts, unsigned nThreads);
 
   // To use profiling info
   void getAnalysisUsage(AnalysisUsage &AU) const;
@@ -69,166 +172,153 @@ public:
   }
 };
 
-// Compute the path through the DAG from its path number
-std::vector<BasicBlock*> LSTMStaticEstimatorPass::computePath(BLInstrumentationDag* dag, unsigned pathNo) {
-    unsigned R = pathNo;
-    std::vector<BasicBlock*> path;
-    
-    // errs() << "\n\n\n\nComputing path number: " << pathNo << "\n";
-
-    int foundNode = 0;
-    int breakOut = 0;
-
-   /* 
-    BLInstrumentationEdge* prev4 = NULL;
-    BLInstrumentationEdge* prev3 = NULL;
-    BLInstrumentationEdge* prev2 = NULL;
-    BLInstrumentationEdge* prev1 = NULL;
-    */
-    int found_edge;
-    std::unordered_map<BLInstrumentationEdge*,int> taken;
-
-    BLInstrumentationNode* curNode = (BLInstrumentationNode*)(dag->getRoot());
-    while (1) {
-        BLInstrumentationEdge* nextEdge;
-        unsigned bestEdge = 0;
-        // Add the basic block to the list
-        found_edge = 0;
-        path.push_back(curNode->getBlock());
-	    //errs() << "next edge options: \n";
-        foundNode = 0;
-
-	    for (BLEdgeIterator next = curNode->succBegin(), end = curNode->succEnd(); next != end; next++) {
-            // We want the largest edge that's less than R
-            BLInstrumentationEdge* i = (BLInstrumentationEdge*) *next;
-            /*
-            if (i->getTarget()->getBlock() == NULL) 
-                errs() << i->getTarget() << " weight: " << i->getWeight() << " exit: "
-                   << " name: NULL! \n";
-            else 
-                errs() << i->getTarget() << " weight: " << i->getWeight() << " exit: " 
-                    << " name: " << i->getTarget()->getBlock()->getName().str() << "\n";
-           */
-            
-            unsigned weight = i->getWeight();
-            if (weight <= R && weight >= bestEdge && (taken.find(i) == taken.end() || found_edge == 0)) {
-	        /*if (weight <= R && weight >= bestEdge && (found_edge == 0 ||
-                ((prev1 != i || prev1 == NULL) && 
-                (prev2 != i || prev2 == NULL) &&
-                (prev3 != i || prev3 == NULL) &&
-                (prev4 != i || prev4 == NULL)))) {
-            */
-                found_edge = 1;
-                bestEdge = weight;
-                nextEdge = i;
-                foundNode = 1;
-            }
-
-            if (R == 0 && (BLInstrumentationNode*)i->getTarget() == (BLInstrumentationNode*)dag->getExit()) {
-                //errs() << "Found exit node with R=0!\n";
-	            bestEdge = weight;
-	            nextEdge = i;
-                foundNode = 1;
-		        break;
-	        }
-            /*
-            else if ((R == 0 || R == 1) && bestEdge == 0)
-                breakOut = 1;
-                break;
-            */
-
-        }
-
-        taken[nextEdge] = 1;
-
-        BLInstrumentationNode* nextNode = (BLInstrumentationNode*)(nextEdge->getTarget());       
-
-	    //errs() << "foundNode = " << foundNode << " R = " << R << " nextNode: " << nextNode << " bestEdge = " << bestEdge << "\n\n"; 	
-
-	    if (nextNode == (BLInstrumentationNode*)dag->getExit()) 
-	        break;
-
- 	    // Terminate on the <null> 
-	    //if (!nextNode->getBlock())
-        //  break;
-        // Move to next node
-	    //prevent loops when weight = 0
-        /*prev4 = prev3;
-        prev3 = prev2;
-	    prev2 = prev1;
-	    prev1 = nextEdge;
-        */
-        curNode = nextNode;
-        R -= bestEdge;
-    }
-    return path;
+// Writes one path as a header line followed by one line per basic block.
+// features and line are reused from path to path.
+static void writePath(std::ostream& out, const std::string& name,
+                      PathID pathNo, unsigned n_real_count,
+                      ArrayRef<BasicBlock*> path,
+                      FeatureExtractor& features, std::string& line) {
+  // Extract features 
+  features.setPath(path);
+  line.clear();
+  line += name;                                     // Function ID
+  line += ' ';
+  appendUnsigned(line, pathNo);
+  line += ' ';
+  appendUnsigned(line, n_real_count);               // Ground truth
+  line += ' ';
+  appendUnsigned(line, path.size());                // Number of BB to follow
+  line += '\n';
+  features.appendFeaturesLSTM(line);                // BBs and features
+  out.write(line.data(), line.size());
 }
-// Iterate through all possible paths in the dag
-void LSTMStaticEstimatorPass::calculatePaths(BLInstrumentationDag* dag) {
-  unsigned nPaths = dag->getNumberOfPaths();
-  errs() << "There are " << nPaths << " paths\n";
-
-  int stride = nPaths / MAX_PATHS;
-  if (stride <= 1)
-      stride = 1;
-
-  errs() << "Using stride " << stride << "\n";
-
-  Function* fn = dag->getRoot()->getBlock()->getParent();
-  PI->setCurrentFunction(fn);
-  unsigned nPathsRun = PI->pathsRun();
-  if (nPathsRun == 0) {
-      errs() << "This function is never run in profiling! Skipping...\n";
+
+// Writes a path as a single line whose last field lists the indices of its
+// blocks in the table of the function.
+static void writeIndexedPath(std::ostream& out, const std::string& name,
+                             PathID pathNo, unsigned n_real_count,
+                             ArrayRef<BasicBlock*> path,
+                             const BlockFeatureTable& table, std::string& line) {
+  line.clear();
+  line += name;
+  line += ' ';
+  appendUnsigned(line, pathNo);
+  line += ' ';
+  appendUnsigned(line, n_real_count);
+  line += ' ';
+  appendUnsigned(line, path.size());
+  line += ' ';
+  for (unsigned b = 0; b < path.size(); b++) {
+    if (b)
+      line += ',';
+    appendUnsigned(line, table.getIndex(path[b]));
   }
-  else {
-      int n_extracted = 0;
-      // Enumerate all paths in this function
-      for (int i=0; i<nPaths; i++) {
-          // Show progress for large values
-          if (i % 10000000 == 0 && i != 0) {
-              errs() << "Computed for " << i << "/" << nPaths << " paths\n";
-          }
+  line += '\n';
+  out.write(line.data(), line.size());
+}
 
-          ProfilePath* curPath = PI->getPath(i);
-          unsigned n_real_count = 0;
-          if (curPath) {
-              n_real_count = curPath->getCount();
-          }
+// Writes the opcode histogram of every block of a function, in block index
+// order, under a "# blocks" line. The indexed paths that follow refer to it.
+static void writeBlockTable(std::ostream& out, const std::string& name,
+                            const BlockFeatureTable& table) {
+  std::string lines;
+  for (unsigned b = 0; b < table.getNumberOfBlocks(); b++)
+    writeOpcodeRow(lines, table.getOpcodes(b), table.getOpcodeWidth());
+  out << "# blocks " << name << " " << table.getNumberOfBlocks() << "\n";
+  out.write(lines.data(), lines.size());
+}
 
-          // We need to subsample the paths, but only if this isn't a pos example
-          bool extract = false;
-          if (n_real_count == 0) {
-              if (i % stride == 0) {
-                  extract = true;
-              }
-          } else {
-              extract = true;
-          }
+// Writes a path as a sparse record. Blocks are encoded once per table
+// index into encoded and copied from there for every path through them.
+static void writeSparsePath(std::ostream& out, PathID pathNo,
+                            unsigned n_real_count, ArrayRef<BasicBlock*> path,
+                            const BlockFeatureTable& table,
+                            std::vector<std::string>& encoded,
+                            std::string& line) {
+  line.clear();
+  appendSparsePath(line, pathNo, n_real_count, path.size());
+  for (unsigned b = 0; b < path.size(); b++) {
+    std::string& block = encoded[table.getIndex(path[b])];
+    if (block.empty())
+      appendSparseBlock(block, table.getOpcodes(path[b]), table.getOpcodeWidth());
+    line += block;
+  }
+  out.write(line.data(), line.size());
+}
 
-    
-          if (extract) {
-              //compute the exact path
-              std::vector<BasicBlock*> path = computePath(dag, i);
-
-              // Extract features 
-              FeatureExtractor* features = new FeatureExtractor(path);
-              std::string fnName = fn->getName();
-              ofs << fnName << " " << i << " "                  // Function ID
-                  << n_real_count << " "                        // Ground truth
-                  << path.size() << "\n"                        // Number of BB to follow
-                  << features->getFeaturesLSTM();               // BBs and features
-              delete features;
-              n_extracted++;
-          }
+std::vector<PathID> LSTMStaticEstimatorPass::selectPaths(const FlatPathDag& dag,
+                                                        const PathCounts& counts,
+                                                        const std::string& name,
+                                                        unsigned budget,
+                                                        raw_ostream& log) {
+  PathID nPaths = dag.getNumberOfPaths();
+
+  // Positive examples come straight from the profile
+  std::vector<PathID> executed;
+  for (PathCounts::const_iterator i = counts.begin(), e = counts.end(); i != e; ++i) {
+      if (i->first < nPaths)
+          executed.push_back(i->first);
+      else
+          log << "WARNING: profiled path " << i->first << " is out of range\n";
+  }
+
+  // Negative examples are sampled from the rest
+  std::vector<PathID> negatives =
+      samplePaths(dag, Sampling, budget, executed,
+                  getFunctionSeed(name, SampleSeed));
+
+  std::vector<PathID> ids;
+  std::merge(executed.begin(), executed.end(), negatives.begin(), negatives.end(),
+             std::back_inserter(ids));
+  log << "Selected " << executed.size() << " executed and " << negatives.size()
+      << " sampled paths\n";
+  return ids;
+}
+
+// Decode and extract the selected paths ids[first..last)
+unsigned LSTMStaticEstimatorPass::extractPaths(const FlatPathDag& dag,
+                                               const PathCounts& counts,
+                                               const BlockFeatureTable& table,
+                                               const std::string& name,
+                                               const std::vector<PathID>& ids,
+                                               PathID first, PathID last,
+                                               std::ostream& out) {
+  PathDecoder decoder(dag);
+  FeatureExtractor features(table);
+  std::string line;
+
+  // Sparse records name their unit once, ahead of its first range, then
+  // only carry path numbers
+  std::vector<std::string> encoded;
+  if (Format == FormatSparse)
+      encoded.resize(table.getNumberOfBlocks());
+  if (Format == FormatSparse && first == 0 && first < last) {
+      line.clear();
+      appendSparseUnit(line, name);
+      out.write(line.data(), line.size());
+  }
+
+  for (PathID n = first; n < last; n++) {
+      PathID i = ids[n];
+      PathCounts::const_iterator curPath = counts.find(i);
+      unsigned n_real_count = 0;
+      if (curPath != counts.end()) {
+          n_real_count = curPath->second;
       }
-      errs() << "Extracted " << n_extracted << " paths for this function\n\n";
+
+      if (Format == FormatIndexed)
+          writeIndexedPath(out, name, i, n_real_count, decoder.decode(i), table, line);
+      else if (Format == FormatSparse)
+          writeSparsePath(out, i, n_real_count, decoder.decode(i), table,
+                          encoded, line);
+      else
+          writePath(out, name, i, n_real_count, decoder.decode(i), features, line);
   }
+  return last - first;
 }
 
-// Entry point of the module
-void LSTMStaticEstimatorPass::runOnFunction(std::vector<Constant*> &ftInit,
-                                 Function &F, Module &M) {
-  errs() << "Running on function " << F.getName() << "\n";
+FlatPathDag* LSTMStaticEstimatorPass::buildDag(Function &F, raw_ostream& log) {
+  log << "Running on function " << F.getName() << "\n";
 
   /* 
   if (F.getName().compare("_ZN11DataOutBase12write_povrayILi3ELi4EEEvRKSt6vectorINS_5PatchIXT_EXT0_EEESaIS3_EERKS1_ISsSaISsEERKNS_11PovrayFlagsERSo")) {
@@ -238,17 +328,215 @@ void LSTMStaticEstimatorPass::runOnFunction(std::vector<Constant*> &ftInit,
  */ 
 
 
-  // Build DAG from CFG
-  BLInstrumentationDag dag = BLInstrumentationDag(F);
-  dag.init();
+  FlatPathDag* flat = buildFlatPathDag(F);
+
+  log << "There are " << flat->getNumberOfPaths() << " paths\n";
+  if (flat->hasOverflow())
+    log << "WARNING: 2^64 paths or more, no path can be numbered!\n";
+  return flat;
+}
+
+// Entry point of the module
+void LSTMStaticEstimatorPass::runOnFunction(Function &F, const PathCounts& counts,
+                                            unsigned budget,
+                                            std::ostream& out, raw_ostream& log) {
+  std::unique_ptr<FlatPathDag> dag(buildDag(F, log));
+
+  if (counts.empty()) {
+      log << "This function is never run in profiling! Skipping...\n";
+      return;
+  }
+  // Regions are numbered on their own, so they are still extracted, but
+  // without counts
+  bool profiled = hasProfiledNumbers(*dag);
+  if (!profiled && !Regions) {
+      log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Skipping...\n";
+      return;
+  }
+
+  // The opcode histogram of each block is computed once
+  BlockFeatureTable table(F, vocab);
+  // Written ahead of the first selected path, as the parallel run writes
+  // it with the first range of a function
+  bool tableWritten = Format != FormatIndexed;
+
+  unsigned n_extracted = 0;
+  if (Regions) {
+      PathRegions regions(*dag, RegionPaths);
+      std::vector<PathCounts> regionCounts(regions.getNumberOfRegions());
+      if (profiled)
+          regionCounts = regions.getRegionCounts(counts);
+      else
+          log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Region paths are unlabelled\n";
+      log << "Split into " << regions.getNumberOfRegions() << " regions with "
+          << regions.getNumberOfPaths() << " paths\n";
+
+      for (unsigned r = 0; r < regions.getNumberOfRegions(); r++) {
+          const FlatPathDag& region = regions.getRegion(r);
+          std::string name = getRegionName(F.getName(), r);
+          std::vector<PathID> ids = selectPaths(region, regionCounts[r], name,
+                                                budget, log);
+          if (!tableWritten && !ids.empty()) {
+              writeBlockTable(out, F.getName(), table);
+              tableWritten = true;
+          }
+          n_extracted += extractPaths(region, regionCounts[r], table, name, ids,
+                                      0, ids.size(), out);
+      }
+  }
+  else {
+      std::vector<PathID> ids = selectPaths(*dag, counts, F.getName(), budget, log);
+      if (!tableWritten && !ids.empty())
+          writeBlockTable(out, F.getName(), table);
+      n_extracted = extractPaths(*dag, counts, table, F.getName(), ids,
+                                 0, ids.size(), out);
+  }
+  log << "Extracted " << n_extracted << " paths for this function\n\n";
+}
+
+std::vector<unsigned> LSTMStaticEstimatorPass::getBudgets(const std::vector<PathID>& nPaths,
+                                                         const std::vector<const PathCounts*>& counts) {
+  if (ModuleBudget == 0)
+    return std::vector<unsigned>(nPaths.size(), FunctionBudget);
+
+  // A function can take at most the paths that never ran
+  std::vector<unsigned> caps(nPaths.size(), 0);
+  for (unsigned i = 0; i < nPaths.size(); i++) {
+    PathID executed = std::distance(counts[i]->begin(),
+                                    counts[i]->lower_bound(nPaths[i]));
+    caps[i] = std::min<PathID>(FunctionBudget, nPaths[i] - executed);
+  }
+  return allocateBudget(ModuleBudget, caps);
+}
+
+void LSTMStaticEstimatorPass::runParallel(const std::vector<Function*>& functions,
+                                          const std::vector<PathCounts>& counts,
+                                          unsigned nThreads) {
+  // Number every function first, so that the module budget can be split
+  std::vector<std::unique_ptr<FlatPathDag>> dags(functions.size());
+  std::vector<std::unique_ptr<PathRegions>> regions(functions.size());
+  std::vector<std::vector<PathCounts> > regionCounts(functions.size());
+  std::vector<std::unique_ptr<BlockFeatureTable>> tables(functions.size());
+  // Profiled, and either with path IDs that match the profile or split
+  // into regions
+  std::vector<char> used(functions.size(), 0);
+  runOrdered(nThreads, functions.size(),
+             [&](unsigned i, std::ostream& /*out*/, raw_ostream& log) {
+               dags[i].reset(buildDag(*functions[i], log));
+
+               if (counts[i].empty()) {
+                 log << "This function is never run in profiling! Skipping...\n";
+                 dags[i].reset();
+                 return;
+               }
+               bool profiled = hasProfiledNumbers(*dags[i]);
+               if (!profiled && !Regions) {
+                 log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Skipping...\n";
+                 dags[i].reset();
+                 return;
+               }
+               used[i] = 1;
+
+               tables[i].reset(new BlockFeatureTable(*functions[i], vocab));
+               if (Regions) {
+                 regions[i].reset(new PathRegions(*dags[i], RegionPaths));
+                 regionCounts[i].resize(regions[i]->getNumberOfRegions());
+                 if (profiled)
+                   regionCounts[i] = regions[i]->getRegionCounts(counts[i]);
+                 else
+                   log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Region paths are unlabelled\n";
+                 log << "Split into " << regions[i]->getNumberOfRegions()
+                     << " regions with " << regions[i]->getNumberOfPaths()
+                     << " paths\n";
+               }
+             }, ofs);
+
+  // The dags to extract, in output order: whole functions or their regions
+  std::vector<const FlatPathDag*> units;
+  std::vector<const PathCounts*> unitCounts;
+  std::vector<std::string> unitNames;
+  std::vector<unsigned> unitFunction;
+  std::vector<PathID> nPaths;
+  for (unsigned i = 0; i < functions.size(); i++) {
+    if (!used[i])
+      continue;
 
-  // give each path a unique integer value
-  dag.calculatePathNumbers();
+    if (!Regions) {
+      units.push_back(dags[i].get());
+      unitCounts.push_back(&counts[i]);
+      unitNames.push_back(functions[i]->getName());
+      unitFunction.push_back(i);
+      nPaths.push_back(dags[i]->getNumberOfPaths());
+      continue;
+    }
+    for (unsigned r = 0; r < regions[i]->getNumberOfRegions(); r++) {
+      units.push_back(&regions[i]->getRegion(r));
+      unitCounts.push_back(&regionCounts[i][r]);
+      unitNames.push_back(getRegionName(functions[i]->getName(), r));
+      unitFunction.push_back(i);
+      nPaths.push_back(units.back()->getNumberOfPaths());
+    }
+  }
 
-  errs() << "Starting calculatePaths..." << "\n";
- 
-  // Calculate the features for each path 
-  calculatePaths(&dag);
+  // Then pick the paths, so the work can be split by selected paths
+  std::vector<unsigned> budgets = getBudgets(nPaths, unitCounts);
+  std::vector<std::vector<PathID> > selected(units.size());
+  std::vector<PathID> nSelected(units.size(), 0);
+  runOrdered(nThreads, units.size(),
+             [&](unsigned u, std::ostream& /*out*/, raw_ostream& log) {
+               selected[u] = selectPaths(*units[u], *unitCounts[u], unitNames[u],
+                                         budgets[u], log);
+               nSelected[u] = selected[u].size();
+             }, ofs);
+
+  PathRanges ranges(nSelected, ChunkSize);
+  std::vector<unsigned> extracted(ranges.size(), 0);
+  unsigned n_extracted = 0;
+
+  // Functions are freed once their last range is flushed. Ranges are
+  // flushed in order, so every function before that one is done too.
+  unsigned released = 0;
+  unsigned releasedUnits = 0;
+  auto release = [&](unsigned end) {
+    for (; released < end; released++) {
+      dags[released].reset();
+      regions[released].reset();
+      tables[released].reset();
+      std::vector<PathCounts>().swap(regionCounts[released]);
+    }
+    for (; releasedUnits < units.size() && unitFunction[releasedUnits] < end;
+         releasedUnits++)
+      std::vector<PathID>().swap(selected[releasedUnits]);
+  };
+  errs() << "Extracting " << ranges.size() << " ranges of paths\n";
+  runOrdered(nThreads, ranges.size(),
+             [&](unsigned t, std::ostream& out, raw_ostream& /*log*/) {
+               PathRange r = ranges[t];
+               // The first range of a function brings its block table
+               unsigned f = unitFunction[r.function];
+               if (Format == FormatIndexed &&
+                   (t == 0 || unitFunction[ranges[t - 1].function] != f))
+                 writeBlockTable(out, functions[f]->getName(), *tables[f]);
+               extracted[t] = extractPaths(*units[r.function], *unitCounts[r.function],
+                                           *tables[unitFunction[r.function]],
+                                           unitNames[r.function], selected[r.function],
+                                           r.first, r.last, out);
+             }, ofs,
+             [&](unsigned t) {
+               // Report once the last range of a function is written
+               unsigned u = ranges[t].function;
+               n_extracted += extracted[t];
+               bool lastRange = ranges[t].last == nSelected[u];
+               bool lastUnit = u + 1 == units.size() ||
+                               unitFunction[u + 1] != unitFunction[u];
+               if (lastRange && lastUnit) {
+                 errs() << "Extracted " << n_extracted << " paths for "
+                        << functions[unitFunction[u]]->getName() << "\n";
+                 n_extracted = 0;
+               }
+               release(lastRange && lastUnit ? unitFunction[u] + 1
+                                             : unitFunction[u]);
+             });
 }
 
 bool LSTMStaticEstimatorPass::runOnModule(Module &M) {
@@ -257,9 +545,11 @@ bool LSTMStaticEstimatorPass::runOnModule(Module &M) {
   PI = &getAnalysis<PathProfileInfo>();
 
   // Start outputs
-  std::string fname = "feature_output.csv";
+  bool sparse = Format == FormatSparse;
+  std::string fname = sparse ? "feature_output.lstm" : "feature_output.csv";
   errs() << "Writing to " << fname << "\n";
-  ofs.open(fname, std::ofstream::out);
+  ofs.open(fname, sparse ? std::ofstream::out | std::ofstream::binary
+                         : std::ofstream::out);
 
   // No main, no instrumentation!
   Function *Main = M.getFunction("main");
@@ -272,13 +562,40 @@ bool LSTMStaticEstimatorPass::runOnModule(Module &M) {
     return false;
   }
 
-  std::vector<Constant*> ftInit;
-  unsigned functionNumber = 0;
+  // The file starts with the opcode of each column
+  if (CompactOpcodes)
+    vocab = OpcodeVocabulary(M);
+  errs() << "Counting " << vocab.getWidth() << " opcodes\n";
+  if (sparse) {
+    std::string header;
+    appendSparseHeader(header, vocab.getOpcodes());
+    ofs.write(header.data(), header.size());
+  }
+  else {
+    ofs << vocab.getHeader();
+  }
+
+  // Profile counts are read up front; PathProfileInfo is not thread safe
+  std::vector<Function*> functions;
+  std::vector<PathCounts> counts;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
     if (F->isDeclaration())
       continue;
 
-    runOnFunction(ftInit, *F, M);
+    functions.push_back(&*F);
+    counts.push_back(getPathCounts(PI, &*F));
+  }
+
+  // A module budget is split once every function is numbered, which the
+  // parallel driver does anyway; it then also runs on a single thread.
+  unsigned nThreads = getWorkerCount(NumThreads);
+  if (nThreads <= 1 && ModuleBudget == 0) {
+    for (unsigned i = 0; i < functions.size(); i++)
+      runOnFunction(*functions[i], counts[i], FunctionBudget, ofs, errs());
+  }
+  else {
+    errs() << "Extracting with " << nThreads << " threads\n";
+    runParallel(functions, counts, nThreads);
   }
 
   ofs.close();
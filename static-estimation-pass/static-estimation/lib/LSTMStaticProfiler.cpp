@@ -22,12 +22,16 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 #include <fstream>
+#include <memory>
 #include <vector>
-#include <unordered_map>
 
 
+#include "AsyncWriter.h"
 #include "BLInstrumentation.h"
+#include "BlockFeatures.h"
 #include "FeatureExtractor.h"
+#include "NumberFormat.h"
+#include "PathEnumerator.h"
 
 #define MAX_PATHS 1000
 
@@ -38,18 +42,15 @@ private:
   // Profiling
   PathProfileInfo* PI;
 
-  // File for output
-  std::ofstream ofs;
+  // File for output, written by a background thread
+  AsyncOutputFile ofs;
 
   // Instruments each function with path profiling.  'main' is instrumented
   // with code to save the profile to disk.
   bool runOnModule(Module &M);
 
-  // Calculate the path for a single ID
-  std::vector<BasicBlock*> computePath(BLInstrumentationDag* dag, unsigned pathNo);
-
   // Calculates all paths for a dag
-  void calculatePaths(BLInstrumentationDag* dag);
+  void calculatePaths(const FlatPathDag& dag);
 
   // Analyzes the function for Ball-Larus path profiling, and inserts code.
   void runOnFunction(std::vector<Constant*> &ftInit, Function &F, Module &M);
@@ -69,78 +70,20 @@ public:
   }
 };
 
-// Compute the path through the DAG from its path number
-std::vector<BasicBlock*> LSTMStaticProfilerPass::computePath(BLInstrumentationDag* dag, unsigned pathNo) {
-    unsigned R = pathNo;
-    std::vector<BasicBlock*> path;
-
-    BLInstrumentationNode* prev2;
-    BLInstrumentationNode* prev1;
-    //std::unordered_map<BLInstrumentationNode*,int> visited;
-
-    BLInstrumentationNode* curNode = (BLInstrumentationNode*)(dag->getRoot());
-    while (1) {
-        BLInstrumentationEdge* nextEdge;
-        unsigned bestEdge = 0;
-        // Add the basic block to the list
-
-        path.push_back(curNode->getBlock());
-	//visited[curNode] = 1;
-	//errs() << "next edge options: ";
-        
-	for (BLEdgeIterator next = curNode->succBegin(), end = curNode->succEnd(); next != end; next++) {
-            // We want the largest edge that's less than R
-            BLInstrumentationEdge* i = (BLInstrumentationEdge*) *next;
-	    //errs() << i << " ";
-            unsigned weight = i->getWeight();
-            //if (weight <= R && weight >= bestEdge && visited.find((BLInstrumentationNode*)i->getTarget()) == visited.end()) 
-	    if (weight <= R && weight >= bestEdge && prev1 != (BLInstrumentationNode*)i->getTarget()) {
-                bestEdge = weight;
-                nextEdge = i;
-            }
-	    
-	    if (R == 0 && (BLInstrumentationNode*)i->getTarget() == (BLInstrumentationNode*)dag->getExit()) {
-		//errs() << "Found exit node with R=0!\n";
-		bestEdge = weight;
-		nextEdge = i;
-		break;
-	    }
-	    
-        }
-	//errs() << "\n";
-	
-        BLInstrumentationNode* nextNode = (BLInstrumentationNode*)(nextEdge->getTarget());       
-
-	//errs() << "R = " << R << " nextNode: " << nextNode << " bestEdge = " << bestEdge << "\n"; 	
-
-	if (nextNode == (BLInstrumentationNode*)dag->getExit()) 
-	  break;
-
- 	// Terminate on the <null> 
-	//if (!nextNode->getBlock())
-        //  break;
-        // Move to next node
-	//prevent loops when weight = 0
-	prev2 = prev1;
-	prev1 = curNode;
-
-        curNode = nextNode;
-        R -= bestEdge;
-    }
-    return path;
-}
 // Iterate through all possible paths in the dag
-void LSTMStaticProfilerPass::calculatePaths(BLInstrumentationDag* dag) {
-  unsigned nPaths = dag->getNumberOfPaths();
+void LSTMStaticProfilerPass::calculatePaths(const FlatPathDag& dag) {
+  PathID nPaths = dag.getNumberOfPaths();
   errs() << "There are " << nPaths << " paths\n";
+  if (dag.hasOverflow())
+    errs() << "WARNING: 2^64 paths or more, no path can be numbered!\n";
 
-  int stride = nPaths / MAX_PATHS;
+  PathID stride = nPaths / MAX_PATHS;
   if (stride <= 1)
       stride = 1;
 
   errs() << "Using stride " << stride << "\n";
 
-  Function* fn = dag->getRoot()->getBlock()->getParent();
+  Function* fn = dag.getFunction();
   // PI->setCurrentFunction(fn);
   // unsigned nPathsRun = PI->pathsRun();
   // if (nPathsRun == 0) {
@@ -148,14 +91,22 @@ void LSTMStaticProfilerPass::calculatePaths(BLInstrumentationDag* dag) {
   // }
   // else {
       int n_extracted = 0;
+      // The opcode histogram of each block is computed once
+      OpcodeVocabulary vocab;
+      BlockFeatureTable table(*fn, vocab);
+      FeatureExtractor features(table);
+      std::string fnName = fn->getName();
+      std::string line;
       // Enumerate all paths in this function
-      for (int i=0; i<nPaths; i++) {
+      PathEnumerator paths(dag);
+      while (paths.next()) {
+          PathID i = paths.getPathNumber();
           // Show progress for large values
           if (i % 100000 == 0 && i != 0) {
               errs() << "Computed for " << i << "/" << nPaths << " paths\n";
           }
 
-          std::vector<BasicBlock*> path = computePath(dag, i);
+          const std::vector<BasicBlock*>& path = paths.getPath();
           // ProfilePath* curPath = PI->getPath(i);
           // unsigned n_real_count = 0;
           // if (curPath) {
@@ -175,13 +126,16 @@ void LSTMStaticProfilerPass::calculatePaths(BLInstrumentationDag* dag) {
     
           if (extract) {
               // Extract features 
-              FeatureExtractor* features = new FeatureExtractor(path);
-              std::string fnName = fn->getName();
-              ofs << fnName << " " << i << " "                  // Function ID
-                  << "1" << " "                        // Ground truth
-                  << path.size() << "\n"                        // Number of BB to follow
-                  << features->getFeaturesLSTM();               // BBs and features
-              delete features;
+              features.setPath(path);
+              line.clear();
+              line += fnName;                                   // Function ID
+              line += ' ';
+              appendUnsigned(line, i);
+              line += " 1 ";                                    // Ground truth
+              appendUnsigned(line, path.size());                // Number of BB to follow
+              line += '\n';
+              features.appendFeaturesLSTM(line);                // BBs and features
+              ofs.write(line.data(), line.size());
               n_extracted++;
           }
       }
@@ -202,17 +156,10 @@ void LSTMStaticProfilerPass::runOnFunction(std::vector<Constant*> &ftInit,
   */	  
 
 
-  // Build DAG from CFG
-  BLInstrumentationDag dag = BLInstrumentationDag(F);
-  dag.init();
-
-  // give each path a unique integer value
-  dag.calculatePathNumbers();
+  std::unique_ptr<FlatPathDag> dag(buildFlatPathDag(F));
 
   errs() << "Starting calculatePaths..." << "\n";
- 
-  // Calculate the features for each path 
-  calculatePaths(&dag);
+  calculatePaths(*dag);
 }
 
 bool LSTMStaticProfilerPass::runOnModule(Module &M) {
@@ -236,6 +183,9 @@ bool LSTMStaticProfilerPass::runOnModule(Module &M) {
     return false;
   }
 
+  // The file starts with the opcode of each column
+  ofs << OpcodeVocabulary().getHeader();
+
   std::vector<Constant*> ftInit;
   unsigned functionNumber = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
@@ -0,0 +1,141 @@
+#include "NumberFormat.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Significant digits of %g
+#define SIGNIFICANT 6
+#define FEATURE_WIDTH 4
+
+namespace {
+    const char DigitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    const uint64_t PowersOf10[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+    };
+
+    // 1e-5 .. 1e6, to guess the decimal exponent of a value
+    const double DecimalPowers[] = {
+        1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6
+    };
+
+    // m * 10^k / 2^shift, rounded to the nearest integer with ties to even
+    // like printf. m * 10^k must fit in 64 bits and shift be in [1, 63].
+    uint64_t scaleRound(uint64_t m, unsigned k, unsigned shift) {
+        uint64_t x = m * PowersOf10[k];
+        uint64_t q = x >> shift;
+        uint64_t rest = x & ((uint64_t(1) << shift) - 1);
+        uint64_t half = uint64_t(1) << (shift - 1);
+        if (rest > half || (rest == half && (q & 1)))
+            q++;
+        return q;
+    }
+
+    // Right aligns [begin, end) in FEATURE_WIDTH characters at p
+    char* pad(char* p, const char* begin, const char* end) {
+        for (long n = end - begin; n < FEATURE_WIDTH; n++)
+            *p++ = ' ';
+        memcpy(p, begin, end - begin);
+        return p + (end - begin);
+    }
+
+    char* writeFeatureSlow(char* p, float value) {
+        return p + snprintf(p, MAX_FEATURE_CHARS, "%4g", value);
+    }
+}
+
+char* writeUnsigned(char* p, uint64_t n) {
+    char digits[20];
+    char* d = digits + sizeof(digits);
+    while (n >= 100) {
+        unsigned pair = n % 100;
+        n /= 100;
+        d -= 2;
+        memcpy(d, DigitPairs + 2 * pair, 2);
+    }
+    if (n >= 10) {
+        d -= 2;
+        memcpy(d, DigitPairs + 2 * n, 2);
+    }
+    else {
+        *--d = '0' + n;
+    }
+    size_t length = digits + sizeof(digits) - d;
+    memcpy(p, d, length);
+    return p + length;
+}
+
+// Features are mostly ratios and small counts, which %g prints without an
+// exponent. Those are rounded exactly from the bits of the float; the rest
+// (exponents, denormals, infinities, NaNs) are left to snprintf.
+char* writeFeature(char* p, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bool negative = bits >> 31;
+    unsigned biased = (bits >> 23) & 0xff;
+
+    char text[MAX_FEATURE_CHARS];
+    char* t = text;
+    if (negative)
+        *t++ = '-';
+
+    if ((bits & 0x7fffffff) == 0) {
+        *t++ = '0';
+        return pad(p, text, t);
+    }
+
+    // value = m * 2^-shift, for values in [2^-14, 2^20)
+    if (biased < 127 - 14 || biased >= 127 + 20)
+        return writeFeatureSlow(p, value);
+    uint64_t m = (bits & 0x7fffff) | 0x800000;
+    unsigned shift = 150 - biased;
+
+    double magnitude = negative ? -(double)value : (double)value;
+    int exponent = 6;
+    while (exponent > -5 && magnitude < DecimalPowers[exponent + 5])
+        exponent--;
+
+    // Find the exponent of the value rounded to SIGNIFICANT digits
+    uint64_t n;
+    while (1) {
+        if (exponent < -4 || exponent >= SIGNIFICANT)
+            return writeFeatureSlow(p, value);
+        n = scaleRound(m, SIGNIFICANT - 1 - exponent, shift);
+        if (n >= PowersOf10[SIGNIFICANT])
+            exponent++;
+        else if (n < PowersOf10[SIGNIFICANT - 1])
+            exponent--;
+        else
+            break;
+    }
+
+    char digits[SIGNIFICANT];
+    writeUnsigned(digits, n);
+    unsigned nDigits = SIGNIFICANT;
+    // Trailing zeros of the fraction go
+    unsigned nIntegral = exponent >= 0 ? exponent + 1 : 0;
+    while (nDigits > nIntegral && digits[nDigits - 1] == '0')
+        nDigits--;
+
+    if (exponent >= 0) {
+        memcpy(t, digits, nIntegral);
+        t += nIntegral;
+        if (nDigits > nIntegral) {
+            *t++ = '.';
+            memcpy(t, digits + nIntegral, nDigits - nIntegral);
+            t += nDigits - nIntegral;
+        }
+    }
+    else {
+        *t++ = '0';
+        *t++ = '.';
+        for (int z = -1; z > exponent; z--)
+            *t++ = '0';
+        memcpy(t, digits, nDigits);
+        t += nDigits;
+    }
+    return pad(p, text, t);
+}
@@ -2,140 +2,137 @@
 
 #include "OpStatCounter.h"
 
-OpStatCounter::OpStatCounter(std::vector<Instruction*> pathInsts) {
-    IRSet = pathInsts;
-
-    // Various counters
-    integerALU = 0;
-    floatingALU = 0;
-    memory = 0;
-    loads = 0;
-    stores = 0;
-    alloca = 0;
-    branch = 0;
-    compares = 0;
-    equality_checks = 0;
-    relational_checks = 0;
-    other = 0;
-    all = 0;
+#include "llvm/IR/GlobalVariable.h"
+
+OpStatCounter::OpStatCounter(const BlockFeatures& pathCounts) :
+    counts(pathCounts) {
 }
 
 float OpStatCounter::get_percentage(int val) {
-    if (all == 0)
+    if (counts.n_instructions == 0)
         return 0;
 
-    return val/float(all);
+    return val/float(counts.n_instructions);
 }
 
-featuremap OpStatCounter::get_opstats() {
-    featuremap opstat_map;
-    // Generate totals for insts
-    run_counts();
+void OpStatCounter::get_opstats(float* features) {
+    float all = counts.n_instructions;
     // Calculate percentages. We're doing this to try and normalize features and thus make life
     // easier for when we run classification
-    opstat_map.insert(featurepair("percent_intops", integerALU/float(all)));
-    opstat_map.insert(featurepair("percent_floatops", floatingALU/float(all)));
-    opstat_map.insert(featurepair("percent_memops", memory/float(all)));
-    opstat_map.insert(featurepair("percent_loads", loads/float(all)));
-    opstat_map.insert(featurepair("percent_stores", stores/float(all)));
-    opstat_map.insert(featurepair("percent_alloca", alloca/float(all)));
-    opstat_map.insert(featurepair("percent_branchops", branch/float(all)));
-    opstat_map.insert(featurepair("percent_compares", compares/float(all)));
-    opstat_map.insert(featurepair("percent_equality_checks", equality_checks/float(all)));
-    opstat_map.insert(featurepair("percent_equality_checks", relational_checks/float(all)));
-    opstat_map.insert(featurepair("percent_otherops", other/float(all)));
-    return opstat_map;
+    features[F_PERCENT_INTOPS] = counts.integerALU/all;
+    features[F_PERCENT_FLOATOPS] = counts.floatingALU/all;
+    features[F_PERCENT_MEMOPS] = counts.memory/all;
+    features[F_PERCENT_LOADS] = counts.loads/all;
+    features[F_PERCENT_STORES] = counts.stores/all;
+    features[F_PERCENT_ALLOCA] = counts.alloca/all;
+    features[F_PERCENT_BRANCHOPS] = counts.branch/all;
+    features[F_PERCENT_COMPARES] = counts.compares/all;
+    features[F_PERCENT_EQUALITY_CHECKS] = counts.equality_checks/all;
+    features[F_PERCENT_RELATIONAL_CHECKS] = counts.relational_checks/all;
+    features[F_PERCENT_OTHEROPS] = counts.other/all;
 }
 
-void OpStatCounter::run_counts() {
-    for (auto inst : IRSet) {
-        all++;
-        ICmpInst* icmp;
-        FCmpInst* fcmp;
-        switch(inst->getOpcode()) {
-            // Integer ALU
-            case Instruction::Add :
-            case Instruction::Sub :
-            case Instruction::Mul :
-            case Instruction::UDiv :
-            case Instruction::SDiv :
-            case Instruction::URem :
-            case Instruction::Shl :
-            case Instruction::LShr :
-            case Instruction::AShr :
-            case Instruction::And :
-            case Instruction::Or :
-            case Instruction::Xor :
-            case Instruction::SRem :
-                integerALU++;
-                break;
-
-            // Floating-point ALU
-            case Instruction::FAdd :
-            case Instruction::FSub :
-            case Instruction::FMul :
-            case Instruction::FDiv :
-            case Instruction::FRem :
-                floatingALU++;
-                break;
-
-            // Memory operation
-            case Instruction::Load :
-                loads++;
-                memory++;
-                break;
-
-            case Instruction::Store :
-                stores++;
-                memory++;
-                break;
-
-            case Instruction::Alloca :
-                alloca++;
-                memory++;
-                break;
-
-            case Instruction::GetElementPtr :
-            case Instruction::Fence :
-            case Instruction::AtomicCmpXchg:
-            case Instruction::AtomicRMW:
-                memory++;
-                break;
-
-            // Branch instructions
-            case Instruction::Br :
-            case Instruction::Switch :
-            case Instruction::IndirectBr :
-                branch++;
-                break;
-    
-            case Instruction::ICmp :
-                integerALU++;
-                compares++;
-                icmp = dyn_cast<ICmpInst>(inst);
-                if (icmp->isEquality()) {
-                    equality_checks++;
-                }
-                else {
-                    relational_checks++;
-                }
-                break;
-    
-            case Instruction::FCmp :
-                floatingALU++;
-                compares++;
-                fcmp = dyn_cast<FCmpInst>(inst);
-                if (fcmp->isEquality()) {
-                    equality_checks++;
-                }
-                else {
-                    relational_checks++;
-                }
-                break;
-
-            default:
-                other++;
-                break;
-        }
+// Classifies one instruction. Everything the features need is looked up in
+// this one switch, so a block is walked only once.
+void OpStatCounter::count_instruction(Instruction* inst, BlockFeatures& counts) {
+    ICmpInst* icmp;
+    FCmpInst* fcmp;
+    counts.n_instructions++;
+    switch(inst->getOpcode()) {
+        // Integer ALU
+        case Instruction::Add :
+        case Instruction::Sub :
+        case Instruction::Mul :
+        case Instruction::UDiv :
+        case Instruction::SDiv :
+        case Instruction::URem :
+        case Instruction::Shl :
+        case Instruction::LShr :
+        case Instruction::AShr :
+        case Instruction::And :
+        case Instruction::Or :
+        case Instruction::Xor :
+        case Instruction::SRem :
+            counts.integerALU++;
+            break;
+
+        // Floating-point ALU
+        case Instruction::FAdd :
+        case Instruction::FSub :
+        case Instruction::FMul :
+        case Instruction::FDiv :
+        case Instruction::FRem :
+            counts.floatingALU++;
+            break;
+
+        // Memory operation
+        case Instruction::Load :
+            counts.loads++;
+            counts.memory++;
+            if (isa<GlobalVariable>(inst->getOperand(0))) {
+                counts.n_globals++;
+            }
+            else {
+                counts.n_locals++;
+            }
+            break;
+
+        case Instruction::Store :
+            counts.stores++;
+            counts.memory++;
+            break;
+
+        case Instruction::Alloca :
+            counts.alloca++;
+            counts.memory++;
+            break;
+
+        case Instruction::GetElementPtr :
+        case Instruction::Fence :
+        case Instruction::AtomicCmpXchg:
+        case Instruction::AtomicRMW:
+            counts.memory++;
+            break;
+
+        // Branch instructions
+        case Instruction::Br :
+        case Instruction::Switch :
+        case Instruction::IndirectBr :
+            counts.branch++;
+            break;
+
+        case Instruction::ICmp :
+            counts.integerALU++;
+            counts.compares++;
+            icmp = dyn_cast<ICmpInst>(inst);
+            if (icmp->isEquality()) {
+                counts.equality_checks++;
+            }
+            else {
+                counts.relational_checks++;
+            }
+            break;
+
+        case Instruction::FCmp :
+            counts.floatingALU++;
+            counts.compares++;
+            fcmp = dyn_cast<FCmpInst>(inst);
+            if (fcmp->isEquality()) {
+                counts.equality_checks++;
+            }
+            else {
+                counts.relational_checks++;
+            }
+            break;
+
+        case Instruction::Call :
+            counts.other++;
+            counts.n_function_calls++;
+            counts.n_params += cast<CallInst>(inst)->getNumArgOperands();
+            break;
+
+        default:
+            counts.other++;
+            break;
     }
 }
@@ -0,0 +1,153 @@
+#include "OpcodeHistogram.h"
+#include "NumberFormat.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    const char ZeroRun[] = "0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,";
+
+#ifdef __SSE2__
+    // Bit i of the result is set if counter i of the four at row is zero
+    unsigned zeroMask4(const unsigned* row) {
+        __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(row));
+        __m128i zero = _mm_cmpeq_epi32(v, _mm_setzero_si128());
+        return _mm_movemask_ps(_mm_castsi128_ps(zero));
+    }
+
+    bool isZero16(const unsigned* row) {
+        const __m128i* v = reinterpret_cast<const __m128i*>(row);
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_load_si128(v), _mm_load_si128(v + 1)),
+                                   _mm_or_si128(_mm_load_si128(v + 2), _mm_load_si128(v + 3)));
+        return _mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) == 0xffff;
+    }
+#else
+    unsigned zeroMask4(const unsigned* row) {
+        return (row[0] == 0) | (row[1] == 0) << 1 | (row[2] == 0) << 2 | (row[3] == 0) << 3;
+    }
+
+    bool isZero16(const unsigned* row) {
+        unsigned any = 0;
+        for (unsigned i = 0; i < 16; i++)
+            any |= row[i];
+        return any == 0;
+    }
+#endif
+
+    // Writes four counters, each followed by a separator
+    char* writeCount4(char* p, const unsigned* row) {
+        unsigned zeros = zeroMask4(row);
+        if (zeros == 0xf) {
+            memcpy(p, ZeroRun, 8);
+            return p + 8;
+        }
+        for (unsigned j = 0; j < 4; j++) {
+            if (zeros & (1u << j))
+                *p++ = '0';
+            else
+                p = writeUnsigned(p, row[j]);
+            *p++ = ',';
+        }
+        return p;
+    }
+}
+
+OpcodeVocabulary::OpcodeVocabulary() {
+    for (unsigned op = 0; op < MAX_OPCODE; op++) {
+        columns[op] = op;
+        opcodes.push_back(op);
+    }
+}
+
+OpcodeVocabulary::OpcodeVocabulary(Module& M) {
+    bool used[MAX_OPCODE] = {};
+    for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+        for (Function::iterator bb = F->begin(), be = F->end(); bb != be; ++bb) {
+            for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i) {
+                if (i->getOpcode() < MAX_OPCODE)
+                    used[i->getOpcode()] = true;
+            }
+        }
+    }
+
+    for (unsigned op = 0; op < MAX_OPCODE; op++) {
+        if (used[op]) {
+            columns[op] = opcodes.size();
+            opcodes.push_back(op);
+        }
+    }
+    // Unused opcodes point past the last column
+    for (unsigned op = 0; op < MAX_OPCODE; op++) {
+        if (!used[op])
+            columns[op] = opcodes.size();
+    }
+}
+
+unsigned OpcodeVocabulary::getColumn(unsigned opcode) const {
+    if (opcode >= MAX_OPCODE)
+        return opcodes.size();
+    return columns[opcode];
+}
+
+std::string OpcodeVocabulary::getHeader() const {
+    std::ostringstream header;
+    header << "# opcodes ";
+    std::string sep = "";
+    for (unsigned i = 0; i < opcodes.size(); i++) {
+        header << sep << opcodes[i];
+        sep = ",";
+    }
+    header << "\n";
+    return header.str();
+}
+
+void countOpcodes(BasicBlock* BB, const OpcodeVocabulary& vocab, unsigned* row) {
+    memset(row, 0, OPCODE_ROW_WIDTH * sizeof(unsigned));
+    unsigned width = vocab.getWidth();
+    for (BasicBlock::iterator i = BB->begin(), e = BB->end(); i != e; ++i) {
+        unsigned column = vocab.getColumn(i->getOpcode());
+        if (column < width)
+            row[column]++;
+    }
+}
+
+// Most counters of a block are zero, so whole runs of them are checked at
+// once and copied out as text.
+void writeOpcodeRow(std::string& out, const unsigned* row, unsigned width) {
+    // At most ten digits and a separator per counter
+    char buf[MAX_OPCODE * 11 + 1];
+    char* p = buf;
+    unsigned i = 0;
+    for (; i + 16 <= width; i += 16) {
+        if (isZero16(row + i)) {
+            memcpy(p, ZeroRun, 32);
+            p += 32;
+            continue;
+        }
+        for (unsigned j = i; j < i + 16; j += 4)
+            p = writeCount4(p, row + j);
+    }
+    for (; i + 4 <= width; i += 4)
+        p = writeCount4(p, row + i);
+    for (; i < width; i++) {
+        p = writeUnsigned(p, row[i]);
+        *p++ = ',';
+    }
+    // The last separator ends the line
+    if (p == buf)
+        p++;
+    p[-1] = '\n';
+    out.append(buf, p);
+}
+
+OpcodeRows::OpcodeRows(unsigned nRows) {
+    // Enough spare counters to move the first row to a 64 byte boundary
+    storage.resize(nRows * OPCODE_ROW_WIDTH + 16, 0);
+    uintptr_t address = reinterpret_cast<uintptr_t>(&storage[0]);
+    offset = ((64 - address % 64) % 64) / sizeof(unsigned);
+}
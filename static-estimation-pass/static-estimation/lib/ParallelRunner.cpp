@@ -0,0 +1,136 @@
+#include "ParallelRunner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tasks a worker may finish ahead of the output, per worker thread
+#define TASKS_AHEAD 4
+
+// Most ranges a single function is cut into
+#define MAX_FUNCTION_RANGES (1u << 16)
+
+namespace {
+  // Buffered output of a single task.
+  struct TaskOutput {
+    std::string data;
+    std::string log;
+    bool done;
+
+    TaskOutput() : done(false) {}
+  };
+}
+
+unsigned getWorkerCount(unsigned requested) {
+  if (requested != 0)
+    return requested;
+
+  unsigned hw = std::thread::hardware_concurrency();
+  return hw ? hw : 1;
+}
+
+void runOrdered(unsigned nThreads, unsigned nTasks, const OrderedTask& task,
+                std::ostream& out, const OrderedDone& done) {
+  std::atomic<unsigned> nextTask(0);
+  std::mutex lock;
+  std::condition_variable finished;
+  // Buffered results are bounded: task t only starts once every task
+  // before t - window has been flushed, so it can reuse the result slot
+  // t % window
+  unsigned window = nThreads * TASKS_AHEAD;
+  std::vector<TaskOutput> results(window);
+  unsigned flushed = 0;
+  std::condition_variable progress;
+
+  auto worker = [&]() {
+    while (1) {
+      unsigned t = nextTask++;
+      if (t >= nTasks)
+        break;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        progress.wait(guard, [&]() { return t < flushed + window; });
+      }
+
+      std::ostringstream data;
+      std::string log;
+      raw_string_ostream logStream(log);
+      task(t, data, logStream);
+      logStream.flush();
+
+      std::lock_guard<std::mutex> guard(lock);
+      TaskOutput& result = results[t % window];
+      result.data = data.str();
+      result.log.swap(log);
+      result.done = true;
+      finished.notify_one();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < nThreads; i++)
+    workers.push_back(std::thread(worker));
+
+  // Flush results in task order while the workers keep going
+  for (unsigned t = 0; t < nTasks; t++) {
+    std::string data, log;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      TaskOutput& result = results[t % window];
+      finished.wait(guard, [&]() { return result.done; });
+      data.swap(result.data);
+      log.swap(result.log);
+      result.done = false;
+    }
+    errs() << log;
+    out << data;
+    if (done)
+      done(t);
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      flushed = t + 1;
+    }
+    progress.notify_all();
+  }
+
+  for (auto& w : workers)
+    w.join();
+}
+
+PathRanges::PathRanges(const std::vector<PathID>& nPaths, PathID chunkSize) :
+  _nPaths(nPaths) {
+  if (chunkSize == 0)
+    chunkSize = 1;
+
+  _firstRange.push_back(0);
+  for (unsigned f = 0; f < nPaths.size(); f++) {
+    PathID chunk = chunkSize;
+    PathID nChunks = nPaths[f] / chunk + (nPaths[f] % chunk != 0);
+    if (nChunks > MAX_FUNCTION_RANGES) {
+      chunk = nPaths[f] / MAX_FUNCTION_RANGES +
+              (nPaths[f] % MAX_FUNCTION_RANGES != 0);
+      nChunks = nPaths[f] / chunk + (nPaths[f] % chunk != 0);
+    }
+    _chunkSize.push_back(chunk);
+    _firstRange.push_back(_firstRange.back() + nChunks);
+  }
+}
+
+// Functions without paths have no ranges, so the last function whose first
+// range is at most t is the one t belongs to.
+PathRange PathRanges::operator[](unsigned t) const {
+  unsigned f = std::upper_bound(_firstRange.begin(), _firstRange.end(), t) -
+               _firstRange.begin() - 1;
+  PathRange range;
+  range.function = f;
+  range.first = (t - _firstRange[f]) * _chunkSize[f];
+  range.last = _nPaths[f] - range.first > _chunkSize[f] ?
+               range.first + _chunkSize[f] : _nPaths[f];
+  return range;
+}
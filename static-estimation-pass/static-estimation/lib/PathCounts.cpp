@@ -0,0 +1,16 @@
+#include "PathCounts.h"
+
+PathCounts getPathCounts(PathProfileInfo* PI, Function* F) {
+    PathCounts counts;
+    PI->setCurrentFunction(F);
+    for (ProfilePathIterator i = PI->pathBegin(), e = PI->pathEnd(); i != e; ++i) {
+        // getPath() leaves empty entries behind for paths that never ran
+        if (i->second)
+            counts[i->first] = i->second->getCount();
+    }
+    return counts;
+}
+
+bool hasProfiledNumbers(const FlatPathDag& dag) {
+    return !dag.hasOverflow() && dag.getNumberOfPaths() <= (PathID(1) << 32);
+}
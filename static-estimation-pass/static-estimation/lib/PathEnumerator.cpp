@@ -0,0 +1,127 @@
+#include "PathEnumerator.h"
+
+// Starts the enumeration at the root.
+PathEnumerator::PathEnumerator(const FlatPathDag& dag) :
+  _dag(dag), _pathNumber(0), _last(~PathID(0)), _sharedPrefix(0),
+  _started(false) {
+  push(dag.getRoot(), 0);
+  seek(0);
+}
+
+// Starts the enumeration at path first and stops in front of path last.
+PathEnumerator::PathEnumerator(const FlatPathDag& dag, PathID first,
+                               PathID last) :
+  _dag(dag), _pathNumber(0), _last(last), _sharedPrefix(0), _started(false) {
+  push(dag.getRoot(), 0);
+  seek(first);
+}
+
+// Pushes node onto the DFS stack and its block onto the current path.
+void PathEnumerator::push(unsigned node, PathID base) {
+  Frame frame;
+  frame.node = node;
+  frame.next = _dag.succBegin(node);
+  frame.end = _dag.succEnd(node);
+  frame.base = base;
+  _stack.push_back(frame);
+  _path.push_back(_dag.getBlock(node));
+}
+
+// Descends along path pathNo. Every frame is left pointing just past the
+// edge it took, except the last one, which points at its exit edge so that
+// next() picks that up first.
+void PathEnumerator::seek(PathID pathNo) {
+  if(pathNo >= _dag.getNumberOfPaths()) {
+    _stack.clear();
+    _path.clear();
+    return;
+  }
+
+  PathID R = pathNo;
+  while(1) {
+    Frame& top = _stack.back();
+    unsigned edge = _dag.selectEdge(top.node, R);
+    unsigned target = _dag.getTarget(edge);
+
+    if(target == _dag.getExit()) {
+      top.next = edge;
+      return;
+    }
+
+    top.next = edge + 1;
+    R -= _dag.getWeight(edge);
+    push(target, top.base + _dag.getWeight(edge));
+  }
+}
+
+// Resumes the DFS until the next edge into the exit node is found.
+bool PathEnumerator::next() {
+  // Before the first path nothing is shared.
+  _sharedPrefix = _started ? _path.size() : 0;
+  _started = true;
+
+  while(!_stack.empty()) {
+    Frame& top = _stack.back();
+
+    if(top.next == top.end) {
+      _stack.pop_back();
+      _path.pop_back();
+      if(_path.size() < _sharedPrefix)
+        _sharedPrefix = _path.size();
+      continue;
+    }
+
+    unsigned edge = top.next++;
+    unsigned target = _dag.getTarget(edge);
+    PathID pathNumber = top.base + _dag.getWeight(edge);
+
+    if(target == _dag.getExit()) {
+      if(pathNumber >= _last)
+        break;
+
+      _pathNumber = pathNumber;
+      return(true);
+    }
+
+    push(target, pathNumber);
+  }
+
+  _stack.clear();
+  _path.clear();
+  return(false);
+}
+
+// Path number of the current path.
+PathID PathEnumerator::getPathNumber() const {
+  return(_pathNumber);
+}
+
+// Blocks of the current path.
+const std::vector<BasicBlock*>& PathEnumerator::getPath() const {
+  return(_path);
+}
+
+// Number of leading blocks unchanged since the previous path.
+unsigned PathEnumerator::getSharedPrefix() const {
+  return(_sharedPrefix);
+}
+
+PathDecoder::PathDecoder(const FlatPathDag& dag) : _dag(dag) {}
+
+// Follows, from the root, the edge with the largest weight not above the
+// remaining path number until the exit is reached.
+const std::vector<BasicBlock*>& PathDecoder::decode(PathID pathNo) {
+  _path.clear();
+  _edges.clear();
+
+  unsigned node = _dag.getRoot();
+  PathID R = pathNo;
+  while(node != _dag.getExit()) {
+    _path.push_back(_dag.getBlock(node));
+    unsigned edge = _dag.selectEdge(node, R);
+    _edges.push_back(edge);
+    R -= _dag.getWeight(edge);
+    node = _dag.getTarget(edge);
+  }
+  return(_path);
+}
@@ -0,0 +1,363 @@
+#include "PathPredictions.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PREDICTION_FILE_MAGIC "PATHPRED"
+#define PREDICTION_FILE_VERSION 1
+#define SECTION_ALIGN 64
+
+namespace {
+  bool isLittleEndian() {
+    const uint16_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1;
+  }
+
+  uint64_t readLE(const char* p, unsigned size) {
+    uint64_t value = 0;
+    for (unsigned i = 0; i < size; i++)
+      value |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return value;
+  }
+
+  void appendLE(std::string& out, uint64_t value, unsigned size) {
+    for (unsigned i = 0; i < size; i++)
+      out += (char)(value >> (8 * i));
+  }
+
+  uint64_t alignSection(uint64_t offset) {
+    return (offset + SECTION_ALIGN - 1) & ~uint64_t(SECTION_ALIGN - 1);
+  }
+
+  // FNV-1a
+  uint64_t hashName(const char* name, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+      hash ^= (unsigned char)name[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  // One line of a CSV file
+  struct Prediction {
+    PathID id;
+    double score;
+    size_t line;
+  };
+
+  bool byID(const Prediction& a, const Prediction& b) {
+    return a.id < b.id || (a.id == b.id && a.line < b.line);
+  }
+}
+
+const double* FunctionPredictions::find(PathID id) const {
+  const PathID* i = std::lower_bound(ids, ids + size, id);
+  if (i == ids + size || *i != id)
+    return NULL;
+  return &scores[i - ids];
+}
+
+PathPredictions::PathPredictions()
+    : _nPredictions(0), _mapping(NULL), _mappingSize(0) {
+}
+
+PathPredictions::~PathPredictions() {
+  unmap();
+}
+
+void PathPredictions::unmap() {
+  if (_mapping)
+    munmap(_mapping, _mappingSize);
+  _mapping = NULL;
+  _mappingSize = 0;
+}
+
+bool PathPredictions::load(const std::string& fname, std::string& error) {
+  unmap();
+  _functions.clear();
+  _slots.clear();
+  _ids.clear();
+  _scores.clear();
+  _names.clear();
+  _nPredictions = 0;
+
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = "cannot open " + fname;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    error = "cannot read " + fname;
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return true;
+  }
+
+  _mappingSize = st.st_size;
+  _mapping = mmap(NULL, _mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (_mapping == MAP_FAILED) {
+    _mapping = NULL;
+    error = "cannot map " + fname;
+    return false;
+  }
+
+  const char* data = static_cast<const char*>(_mapping);
+  size_t magic = strlen(PREDICTION_FILE_MAGIC);
+  bool ok;
+  if (_mappingSize >= magic && memcmp(data, PREDICTION_FILE_MAGIC, magic) == 0) {
+    ok = loadBinary(data, _mappingSize, error);
+  }
+  else {
+    // Everything is copied out of the text
+    ok = loadCSV(data, _mappingSize, error);
+    unmap();
+  }
+  if (!ok) {
+    unmap();
+    _functions.clear();
+    return false;
+  }
+
+  buildIndex();
+  return true;
+}
+
+bool PathPredictions::loadBinary(const char* data, size_t size,
+                                 std::string& error) {
+  if (size < sizeof(PredictionFileHeader)) {
+    error = "prediction file header is cut short";
+    return false;
+  }
+  uint64_t version = readLE(data + 8, 4);
+  uint64_t nFunctions = readLE(data + 12, 4);
+  uint64_t nPredictions = readLE(data + 16, 8);
+  uint64_t functionsOffset = readLE(data + 24, 8);
+  uint64_t idsOffset = readLE(data + 32, 8);
+  uint64_t scoresOffset = readLE(data + 40, 8);
+  uint64_t namesOffset = readLE(data + 48, 8);
+  if (version != PREDICTION_FILE_VERSION) {
+    error = "unknown prediction file version";
+    return false;
+  }
+
+  // Every section has to be inside the file, the arrays 8 byte aligned
+  uint64_t maxCount = size / 8;
+  if (nFunctions > maxCount || nPredictions > maxCount ||
+      functionsOffset > size || size - functionsOffset < nFunctions * 32 ||
+      idsOffset > size || size - idsOffset < nPredictions * 8 ||
+      scoresOffset > size || size - scoresOffset < nPredictions * 8 ||
+      namesOffset > size || idsOffset % 8 || scoresOffset % 8) {
+    error = "prediction file sections are out of bounds";
+    return false;
+  }
+
+  const PathID* ids = reinterpret_cast<const PathID*>(data + idsOffset);
+  const double* scores = reinterpret_cast<const double*>(data + scoresOffset);
+  if (!isLittleEndian()) {
+    _ids.resize(nPredictions);
+    _scores.resize(nPredictions);
+    for (uint64_t i = 0; i < nPredictions; i++) {
+      _ids[i] = readLE(data + idsOffset + 8 * i, 8);
+      uint64_t bits = readLE(data + scoresOffset + 8 * i, 8);
+      memcpy(&_scores[i], &bits, sizeof(bits));
+    }
+    ids = _ids.data();
+    scores = _scores.data();
+  }
+
+  _functions.resize(nFunctions);
+  for (uint64_t f = 0; f < nFunctions; f++) {
+    const char* entry = data + functionsOffset + 32 * f;
+    uint64_t nameOffset = readLE(entry, 8);
+    uint64_t nameLength = readLE(entry + 8, 8);
+    uint64_t first = readLE(entry + 16, 8);
+    uint64_t count = readLE(entry + 24, 8);
+    if (nameOffset > size - namesOffset ||
+        nameLength > size - namesOffset - nameOffset ||
+        first > nPredictions || count > nPredictions - first) {
+      error = "prediction file function table is corrupt";
+      return false;
+    }
+
+    FunctionPredictions& fp = _functions[f];
+    fp.name = data + namesOffset + nameOffset;
+    fp.nameLength = nameLength;
+    fp.ids = ids + first;
+    fp.scores = scores + first;
+    fp.size = count;
+  }
+  _nPredictions = nPredictions;
+  return true;
+}
+
+bool PathPredictions::loadCSV(const char* data, size_t size,
+                              std::string& error) {
+  std::unordered_map<std::string, std::vector<Prediction> > byFunction;
+  const char* end = data + size;
+  const char* line = data;
+  size_t lineNo = 0;
+  while (line < end) {
+    const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (!eol)
+      eol = end;
+    lineNo++;
+
+    // The first line names the columns
+    if (lineNo > 1 && eol > line && !(eol - line == 1 && *line == '\r')) {
+      const char* space = static_cast<const char*>(memchr(line, ' ', eol - line));
+      const char* comma = space ?
+          static_cast<const char*>(memchr(space, ',', eol - space)) : NULL;
+      // The numbers are parsed from a terminated copy
+      char number[64];
+      size_t scoreLength = comma ? eol - comma - 1 : 0;
+      if (!comma || scoreLength >= sizeof(number)) {
+        error = "malformed prediction on line " + std::to_string(lineNo);
+        return false;
+      }
+
+      Prediction p;
+      p.line = lineNo;
+      p.id = strtoull(std::string(space + 1, comma).c_str(), NULL, 10);
+      memcpy(number, comma + 1, scoreLength);
+      number[scoreLength] = 0;
+      p.score = strtod(number, NULL);
+      byFunction[std::string(line, space)].push_back(p);
+    }
+    line = eol + 1;
+  }
+
+  // Functions in name order, paths in ID order; a repeated path keeps its
+  // last score
+  std::vector<std::string> names;
+  for (auto& f : byFunction)
+    names.push_back(f.first);
+  std::sort(names.begin(), names.end());
+
+  std::vector<size_t> nameOffsets, firsts, counts;
+  for (auto& name : names) {
+    std::vector<Prediction>& predictions = byFunction[name];
+    std::sort(predictions.begin(), predictions.end(), byID);
+    nameOffsets.push_back(_names.size());
+    _names += name;
+    firsts.push_back(_ids.size());
+    for (size_t i = 0; i < predictions.size(); i++) {
+      if (i + 1 < predictions.size() && predictions[i + 1].id == predictions[i].id)
+        continue;
+      _ids.push_back(predictions[i].id);
+      _scores.push_back(predictions[i].score);
+    }
+    counts.push_back(_ids.size() - firsts.back());
+  }
+
+  // Pointers are only taken once the arrays are complete
+  _functions.resize(names.size());
+  for (unsigned f = 0; f < names.size(); f++) {
+    FunctionPredictions& fp = _functions[f];
+    fp.name = _names.data() + nameOffsets[f];
+    fp.nameLength = names[f].size();
+    fp.ids = _ids.data() + firsts[f];
+    fp.scores = _scores.data() + firsts[f];
+    fp.size = counts[f];
+  }
+  _nPredictions = _ids.size();
+  return true;
+}
+
+void PathPredictions::buildIndex() {
+  size_t nSlots = 1;
+  while (nSlots < 2 * _functions.size())
+    nSlots *= 2;
+  _slots.assign(nSlots, 0);
+  for (unsigned f = 0; f < _functions.size(); f++) {
+    size_t slot = hashName(_functions[f].name, _functions[f].nameLength) & (nSlots - 1);
+    while (_slots[slot])
+      slot = (slot + 1) & (nSlots - 1);
+    _slots[slot] = f + 1;
+  }
+}
+
+const FunctionPredictions* PathPredictions::find(const char* name,
+                                                 size_t length) const {
+  if (_functions.empty())
+    return NULL;
+
+  size_t mask = _slots.size() - 1;
+  for (size_t slot = hashName(name, length) & mask; _slots[slot];
+       slot = (slot + 1) & mask) {
+    const FunctionPredictions& fp = _functions[_slots[slot] - 1];
+    if (fp.nameLength == length && memcmp(fp.name, name, length) == 0)
+      return &fp;
+  }
+  return NULL;
+}
+
+bool PathPredictions::writeBinary(const std::string& fname) const {
+  // Written in name order, whatever order the functions were loaded in
+  std::vector<unsigned> order(_functions.size());
+  for (unsigned f = 0; f < order.size(); f++)
+    order[f] = f;
+  std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    const FunctionPredictions& x = _functions[a];
+    const FunctionPredictions& y = _functions[b];
+    return std::string(x.name, x.nameLength) < std::string(y.name, y.nameLength);
+  });
+
+  std::string functions, ids, scores, names;
+  uint64_t first = 0;
+  for (unsigned f : order) {
+    const FunctionPredictions& fp = _functions[f];
+    appendLE(functions, names.size(), 8);
+    appendLE(functions, fp.nameLength, 8);
+    appendLE(functions, first, 8);
+    appendLE(functions, fp.size, 8);
+    names.append(fp.name, fp.nameLength);
+    for (size_t i = 0; i < fp.size; i++) {
+      uint64_t bits;
+      memcpy(&bits, &fp.scores[i], sizeof(bits));
+      appendLE(ids, fp.ids[i], 8);
+      appendLE(scores, bits, 8);
+    }
+    first += fp.size;
+  }
+
+  uint64_t functionsOffset = alignSection(sizeof(PredictionFileHeader));
+  uint64_t idsOffset = alignSection(functionsOffset + functions.size());
+  uint64_t scoresOffset = alignSection(idsOffset + ids.size());
+  uint64_t namesOffset = alignSection(scoresOffset + scores.size());
+
+  std::string file = PREDICTION_FILE_MAGIC;
+  appendLE(file, PREDICTION_FILE_VERSION, 4);
+  appendLE(file, _functions.size(), 4);
+  appendLE(file, first, 8);
+  appendLE(file, functionsOffset, 8);
+  appendLE(file, idsOffset, 8);
+  appendLE(file, scoresOffset, 8);
+  appendLE(file, namesOffset, 8);
+  file.resize(functionsOffset, 0);
+  file += functions;
+  file.resize(idsOffset, 0);
+  file += ids;
+  file.resize(scoresOffset, 0);
+  file += scores;
+  file.resize(namesOffset, 0);
+  file += names;
+
+  std::ofstream out(fname.c_str(), std::ofstream::out | std::ofstream::binary);
+  out.write(file.data(), file.size());
+  out.close();
+  return !out.fail();
+}
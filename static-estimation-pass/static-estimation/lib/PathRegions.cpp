@@ -0,0 +1,141 @@
+#include "PathRegions.h"
+
+#include <algorithm>
+#include <sstream>
+
+// Multiplies a by b, or returns false if the product does not fit.
+static bool mulPaths(PathID& a, PathID b) {
+  if(b != 0 && a > ~PathID(0) / b)
+    return(false);
+  a *= b;
+  return(true);
+}
+
+// Orders the nodes topologically (reverse DFS post order from the root),
+// finds the nodes no edge jumps over and merges the regions between them.
+PathRegions::PathRegions(const FlatPathDag& dag, PathID maxPaths) :
+  _dag(dag), _localWeight(dag.succEnd(dag.getNumberOfNodes() - 1), 0) {
+  unsigned nNodes = dag.getNumberOfNodes();
+
+  std::vector<unsigned> order;
+  std::vector<bool> visited(nNodes, false);
+  std::vector<std::pair<unsigned, unsigned> > stack;
+  stack.push_back(std::make_pair(dag.getRoot(), dag.succBegin(dag.getRoot())));
+  visited[dag.getRoot()] = true;
+  while(!stack.empty()) {
+    unsigned node = stack.back().first;
+    unsigned& edge = stack.back().second;
+    if(edge == dag.succEnd(node)) {
+      order.push_back(node);
+      stack.pop_back();
+      continue;
+    }
+    unsigned target = dag.getTarget(edge++);
+    if(!visited[target]) {
+      visited[target] = true;
+      stack.push_back(std::make_pair(target, dag.succBegin(target)));
+    }
+  }
+  std::reverse(order.begin(), order.end());
+
+  std::vector<unsigned> position(nNodes);
+  for(unsigned p = 0; p < order.size(); p++)
+    position[order[p]] = p;
+
+  // A node is on every path if no edge from an earlier node passes it
+  std::vector<bool> cut(nNodes, false);
+  unsigned reach = 0;
+  for(unsigned p = 0; p < order.size(); p++) {
+    if(reach <= p)
+      cut[order[p]] = true;
+    for(unsigned edge = dag.succBegin(order[p]); edge != dag.succEnd(order[p]);
+        edge++)
+      reach = std::max(reach, position[dag.getTarget(edge)]);
+  }
+
+  // Paths from each node to the next cut node; at a cut node this is the
+  // path count of the region it starts
+  std::vector<PathID> paths(nNodes, 0);
+  for(unsigned p = order.size(); p-- > 0; ) {
+    unsigned node = order[p];
+    for(unsigned edge = dag.succBegin(node); edge != dag.succEnd(node); edge++) {
+      unsigned target = dag.getTarget(edge);
+      PathID add = cut[target] ? 1 : paths[target];
+      paths[node] = add > ~PathID(0) - paths[node] ? ~PathID(0) : paths[node] + add;
+    }
+  }
+
+  // Merge neighbouring regions while the product stays below maxPaths
+  std::vector<unsigned> nodes;
+  PathID merged = paths[dag.getRoot()];
+  for(unsigned p = 0; p < order.size(); p++) {
+    unsigned node = order[p];
+    nodes.push_back(node);
+    if(!cut[node] || p == 0)
+      continue;
+
+    PathID next = merged;
+    bool last = (node == dag.getExit());
+    if(!last && mulPaths(next, paths[node]) && next <= maxPaths) {
+      merged = next;
+      continue;
+    }
+
+    // node closes the region in nodes and opens the next one
+    _regions.push_back(std::unique_ptr<FlatPathDag>(new FlatPathDag(dag, nodes)));
+    _ends.push_back(node);
+
+    const FlatPathDag& region = *_regions.back();
+    for(unsigned n = 0; n + 1 < nodes.size(); n++) {
+      unsigned first = dag.succBegin(nodes[n]);
+      for(unsigned k = 0; first + k != dag.succEnd(nodes[n]); k++)
+        _localWeight[first + k] = region.getWeight(region.succBegin(n) + k);
+    }
+
+    nodes.clear();
+    nodes.push_back(node);
+    merged = paths[node];
+  }
+}
+
+PathID PathRegions::getNumberOfPaths() const {
+  PathID sum = 0;
+  for(unsigned r = 0; r < _regions.size(); r++)
+    sum += _regions[r]->getNumberOfPaths();
+  return(sum);
+}
+
+// Decodes every executed path and sums up the region paths it is made of.
+std::vector<PathCounts> PathRegions::getRegionCounts(const PathCounts& counts) const {
+  std::vector<PathCounts> regionCounts(_regions.size());
+  if(_dag.hasOverflow())
+    return(regionCounts);
+
+  for(PathCounts::const_iterator i = counts.begin(), e = counts.end(); i != e; ++i) {
+    if(i->first >= _dag.getNumberOfPaths())
+      continue;
+
+    unsigned node = _dag.getRoot();
+    PathID R = i->first;
+    PathID local = 0;
+    unsigned r = 0;
+    while(node != _dag.getExit()) {
+      unsigned edge = _dag.selectEdge(node, R);
+      R -= _dag.getWeight(edge);
+      local += _localWeight[edge];
+      node = _dag.getTarget(edge);
+      if(node == _ends[r]) {
+        regionCounts[r][local] += i->second;
+        local = 0;
+        r++;
+      }
+    }
+  }
+  return(regionCounts);
+}
+
+std::string getRegionName(const std::string& fnName, unsigned r) {
+  std::ostringstream name;
+  name << fnName << ".r" << r;
+  return(name.str());
+}
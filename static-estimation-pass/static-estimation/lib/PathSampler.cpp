@@ -0,0 +1,285 @@
+#include "PathSampler.h"
+#include "PathEnumerator.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+
+namespace {
+  // splitmix64; unlike the <random> distributions its output is the same
+  // with every standard library, so samples are reproducible everywhere.
+  class SampleRNG {
+    unsigned long long state;
+
+  public:
+    SampleRNG(unsigned long long seed) : state(seed) {}
+
+    unsigned long long next() {
+      unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, bound]
+    unsigned long long below(unsigned long long bound) {
+      if (bound == ~0ULL)
+        return next();
+      unsigned long long range = bound + 1;
+      unsigned long long limit = ~0ULL - ~0ULL % range;
+      unsigned long long r;
+      do {
+        r = next();
+      } while (r >= limit);
+      return r % range;
+    }
+  };
+
+  // Algorithm R: keeps a uniform sample of at most size of the values
+  // offered so far.
+  class Reservoir {
+    std::vector<PathID> sample;
+    unsigned size;
+    unsigned long long seen;
+
+  public:
+    Reservoir(unsigned size) : size(size), seen(0) {}
+
+    void offer(PathID value, SampleRNG& rng) {
+      seen++;
+      if (sample.size() < size) {
+        sample.push_back(value);
+        return;
+      }
+      unsigned long long j = rng.below(seen - 1);
+      if (j < size)
+        sample[j] = value;
+    }
+
+    unsigned long long getSeen() const { return seen; }
+    const std::vector<PathID>& getSample() const { return sample; }
+  };
+
+  // Seed of stratum i of a sample seeded with seed
+  unsigned long long getStratumSeed(unsigned long long seed, unsigned i) {
+    return seed ^ ((i + 1) * 0xd6e8feb86659fd93ULL);
+  }
+
+  // k distinct positions of [0, n), in no particular order (Floyd)
+  std::vector<PathID> choose(PathID n, unsigned k, SampleRNG& rng) {
+    std::unordered_set<PathID> chosen;
+    std::vector<PathID> sample;
+    for (PathID j = n - k; j < n; j++) {
+      PathID t = rng.below(j);
+      if (!chosen.insert(t).second)
+        t = j;
+      chosen.insert(t);
+      sample.push_back(t);
+    }
+    return sample;
+  }
+
+  // Every (nPaths / budget)-th path number that is not excluded
+  std::vector<PathID> sampleStride(const FlatPathDag& dag, unsigned budget,
+                                   const std::vector<PathID>& exclude) {
+    std::vector<PathID> sample;
+    if (budget == 0)
+      return sample;
+
+    PathID nPaths = dag.getNumberOfPaths();
+    PathID stride = nPaths / budget;
+    if (stride <= 1)
+      stride = 1;
+
+    for (PathID i = 0; i < nPaths; i += stride) {
+      if (!std::binary_search(exclude.begin(), exclude.end(), i))
+        sample.push_back(i);
+      if (nPaths - i <= stride)
+        break;
+    }
+    return sample;
+  }
+
+  // Walks every path of the dag and offers the ones that are not excluded
+  // to the reservoir of their stratum; byLength selects the stratum by the
+  // number of blocks on the path, otherwise everything is one stratum.
+  std::vector<PathID> sampleWalk(const FlatPathDag& dag, bool byLength,
+                                 unsigned budget,
+                                 const std::vector<PathID>& exclude,
+                                 unsigned long long seed) {
+    std::vector<PathID> sample;
+    if (budget == 0)
+      return sample;
+
+    SampleRNG rng(seed);
+    std::map<unsigned, Reservoir> strata;
+    std::vector<PathID>::const_iterator skip = exclude.begin();
+
+    PathEnumerator paths(dag);
+    while (paths.next()) {
+      PathID i = paths.getPathNumber();
+      // Paths come out in increasing order, like exclude
+      while (skip != exclude.end() && *skip < i)
+        ++skip;
+      if (skip != exclude.end() && *skip == i)
+        continue;
+
+      unsigned stratum = byLength ? paths.getPath().size() : 0;
+      std::map<unsigned, Reservoir>::iterator s = strata.find(stratum);
+      if (s == strata.end())
+        s = strata.insert(std::make_pair(stratum, Reservoir(budget))).first;
+      s->second.offer(i, rng);
+    }
+
+    // Every reservoir holds up to the whole budget; keep a uniform subset
+    // of each that matches its share.
+    std::vector<unsigned> caps;
+    for (std::map<unsigned, Reservoir>::iterator s = strata.begin(),
+         e = strata.end(); s != e; ++s)
+      caps.push_back(s->second.getSample().size());
+    std::vector<unsigned> shares = allocateBudget(budget, caps);
+
+    unsigned n = 0;
+    for (std::map<unsigned, Reservoir>::iterator s = strata.begin(),
+         e = strata.end(); s != e; ++s, n++) {
+      const std::vector<PathID>& kept = s->second.getSample();
+      SampleRNG pick(getStratumSeed(seed, n));
+      std::vector<PathID> chosen = choose(kept.size(), shares[n], pick);
+      for (unsigned j = 0; j < chosen.size(); j++)
+        sample.push_back(kept[chosen[j]]);
+    }
+    std::sort(sample.begin(), sample.end());
+    return sample;
+  }
+
+  // Splits the budget evenly across the edges out of the first node with
+  // more than one successor. The paths through each of those edges are a
+  // contiguous range of path numbers, which is sampled uniformly.
+  std::vector<PathID> sampleBranch(const FlatPathDag& dag, unsigned budget,
+                                   const std::vector<PathID>& exclude,
+                                   unsigned long long seed) {
+    unsigned node = dag.getRoot();
+    PathID base = 0;
+    while (node != dag.getExit() && dag.succEnd(node) - dag.succBegin(node) == 1) {
+      unsigned edge = dag.succBegin(node);
+      base += dag.getWeight(edge);
+      node = dag.getTarget(edge);
+    }
+
+    std::vector<PathID> sample;
+    if (node == dag.getExit())
+      return samplePathNumbers(0, dag.getNumberOfPaths(), budget, exclude, seed);
+
+    std::vector<PathID> first, last;
+    std::vector<unsigned> caps;
+    for (unsigned edge = dag.succBegin(node); edge != dag.succEnd(node); edge++) {
+      PathID lo = base + dag.getWeight(edge);
+      PathID hi = lo + dag.getNumberPaths(dag.getTarget(edge));
+      PathID excluded =
+          std::lower_bound(exclude.begin(), exclude.end(), hi) -
+          std::lower_bound(exclude.begin(), exclude.end(), lo);
+      first.push_back(lo);
+      last.push_back(hi);
+      caps.push_back(std::min<PathID>(hi - lo - excluded, budget));
+    }
+    std::vector<unsigned> shares = allocateBudget(budget, caps);
+
+    for (unsigned n = 0; n < shares.size(); n++) {
+      std::vector<PathID> part = samplePathNumbers(first[n], last[n], shares[n],
+                                                   exclude,
+                                                   getStratumSeed(seed, n));
+      sample.insert(sample.end(), part.begin(), part.end());
+    }
+    // The ranges follow the edge weights, so the parts are already in order
+    return sample;
+  }
+}
+
+unsigned long long getFunctionSeed(const std::string& name,
+                                   unsigned long long seed) {
+  // FNV-1a, started from a basis that depends on the module seed
+  unsigned long long hash = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+  for (unsigned char c : name) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::vector<unsigned> allocateBudget(unsigned budget,
+                                     const std::vector<unsigned>& caps) {
+  std::vector<unsigned> shares(caps.size(), 0);
+  while (budget > 0) {
+    std::vector<unsigned> open;
+    for (unsigned i = 0; i < caps.size(); i++)
+      if (shares[i] < caps[i])
+        open.push_back(i);
+    if (open.empty())
+      break;
+
+    // Fewer left than open buckets: one more each for the first ones
+    unsigned share = budget / open.size();
+    if (share == 0) {
+      for (unsigned i = 0; i < budget; i++)
+        shares[open[i]]++;
+      break;
+    }
+
+    for (unsigned i = 0; i < open.size(); i++) {
+      unsigned take = std::min(share, caps[open[i]] - shares[open[i]]);
+      shares[open[i]] += take;
+      budget -= take;
+    }
+  }
+  return shares;
+}
+
+std::vector<PathID> samplePathNumbers(PathID first, PathID last, unsigned k,
+                                      const std::vector<PathID>& exclude,
+                                      unsigned long long seed) {
+  std::vector<PathID>::const_iterator lo =
+      std::lower_bound(exclude.begin(), exclude.end(), first);
+  std::vector<PathID>::const_iterator hi =
+      std::lower_bound(lo, exclude.end(), last);
+
+  PathID available = last - first - (hi - lo);
+  if (k > available)
+    k = available;
+
+  // k distinct values from [0, available)
+  SampleRNG rng(seed);
+  std::vector<PathID> sample = choose(available, k, rng);
+  std::sort(sample.begin(), sample.end());
+
+  // Map the i-th non-excluded value back to its path number
+  PathID skipped = 0;
+  for (unsigned i = 0; i < sample.size(); i++) {
+    PathID pathNo = first + sample[i] + skipped;
+    while (lo != hi && *lo <= pathNo) {
+      ++lo;
+      skipped++;
+      pathNo++;
+    }
+    sample[i] = pathNo;
+  }
+  return sample;
+}
+
+std::vector<PathID> samplePaths(const FlatPathDag& dag, SampleMode mode,
+                                unsigned budget,
+                                const std::vector<PathID>& exclude,
+                                unsigned long long seed) {
+  switch (mode) {
+  case SampleStride:
+    return sampleStride(dag, budget, exclude);
+  case SampleUniform:
+    return samplePathNumbers(0, dag.getNumberOfPaths(), budget, exclude, seed);
+  case SampleReservoir:
+    return sampleWalk(dag, false, budget, exclude, seed);
+  case SampleLength:
+    return sampleWalk(dag, true, budget, exclude, seed);
+  case SampleBranch:
+    return sampleBranch(dag, budget, exclude, seed);
+  }
+  return std::vector<PathID>();
+}
@@ -0,0 +1,174 @@
+#include "SparseLSTM.h"
+#include "NumberFormat.h"
+
+#include <cstring>
+
+void appendVarint(std::string& out, uint64_t value) {
+    char bytes[10];
+    unsigned n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (char)value;
+    out.append(bytes, n);
+}
+
+void appendSparseHeader(std::string& out, const std::vector<unsigned>& opcodes) {
+    out += SPARSE_LSTM_MAGIC;
+    appendVarint(out, SPARSE_LSTM_VERSION);
+    appendVarint(out, opcodes.size());
+    for (unsigned i = 0; i < opcodes.size(); i++)
+        appendVarint(out, opcodes[i]);
+}
+
+void appendSparseUnit(std::string& out, const std::string& name) {
+    out += SPARSE_RECORD_UNIT;
+    appendVarint(out, name.size());
+    out += name;
+}
+
+void appendSparsePath(std::string& out, PathID pathNo, unsigned count,
+                      unsigned nBlocks) {
+    out += SPARSE_RECORD_PATH;
+    appendVarint(out, pathNo);
+    appendVarint(out, count);
+    appendVarint(out, nBlocks);
+}
+
+void appendSparseBlock(std::string& out, const unsigned* row, unsigned width) {
+    unsigned nonzero = 0;
+    for (unsigned i = 0; i < width; i++)
+        nonzero += row[i] != 0;
+
+    appendVarint(out, nonzero);
+    unsigned next = 0;
+    for (unsigned i = 0; i < width; i++) {
+        if (row[i] == 0)
+            continue;
+        appendVarint(out, i - next);
+        appendVarint(out, row[i]);
+        next = i + 1;
+    }
+}
+
+SparseLSTMReader::SparseLSTMReader(const char* data, size_t size)
+    : pos(reinterpret_cast<const unsigned char*>(data)),
+      end(reinterpret_cast<const unsigned char*>(data) + size), failed(false) {
+    size_t magic = strlen(SPARSE_LSTM_MAGIC);
+    if (size < magic || memcmp(data, SPARSE_LSTM_MAGIC, magic) != 0) {
+        failed = true;
+        return;
+    }
+    pos += magic;
+
+    unsigned version, width;
+    if (!readUnsigned(version) || version != SPARSE_LSTM_VERSION ||
+        !readUnsigned(width)) {
+        failed = true;
+        return;
+    }
+    opcodes.resize(width);
+    for (unsigned i = 0; i < width && !failed; i++)
+        readUnsigned(opcodes[i]);
+}
+
+bool SparseLSTMReader::readVarint(uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos == end)
+            break;
+        unsigned char byte = *pos++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+            return true;
+    }
+    failed = true;
+    return false;
+}
+
+bool SparseLSTMReader::readUnsigned(unsigned& value) {
+    uint64_t wide;
+    if (!readVarint(wide) || wide > 0xffffffffu) {
+        failed = true;
+        return false;
+    }
+    value = wide;
+    return true;
+}
+
+bool SparseLSTMReader::next(SparsePath& path) {
+    while (!failed && pos != end) {
+        char type = *pos++;
+        if (type == SPARSE_RECORD_UNIT) {
+            unsigned length;
+            if (!readUnsigned(length) || (size_t)(end - pos) < length) {
+                failed = true;
+                return false;
+            }
+            unit.assign(reinterpret_cast<const char*>(pos), length);
+            pos += length;
+            continue;
+        }
+        if (type != SPARSE_RECORD_PATH) {
+            failed = true;
+            return false;
+        }
+
+        unsigned nBlocks;
+        if (!readVarint(path.pathNo) || !readUnsigned(path.count) ||
+            !readUnsigned(nBlocks))
+            return false;
+
+        path.unit = unit;
+        path.blockEnds.clear();
+        path.columns.clear();
+        path.counts.clear();
+        for (unsigned b = 0; b < nBlocks; b++) {
+            unsigned nonzero;
+            if (!readUnsigned(nonzero))
+                return false;
+            unsigned column = 0;
+            for (unsigned i = 0; i < nonzero; i++) {
+                unsigned gap, count;
+                if (!readUnsigned(gap) || !readUnsigned(count))
+                    return false;
+                column += gap;
+                if (column >= opcodes.size()) {
+                    failed = true;
+                    return false;
+                }
+                path.columns.push_back(column++);
+                path.counts.push_back(count);
+            }
+            path.blockEnds.push_back(path.columns.size());
+        }
+        return true;
+    }
+    return false;
+}
+
+void appendDensePath(std::string& out, const SparsePath& path, unsigned width) {
+    out += path.unit;
+    out += ' ';
+    appendUnsigned(out, path.pathNo);
+    out += ' ';
+    appendUnsigned(out, path.count);
+    out += ' ';
+    appendUnsigned(out, path.getNumberOfBlocks());
+    out += '\n';
+
+    unsigned entry = 0;
+    for (unsigned b = 0; b < path.getNumberOfBlocks(); b++) {
+        for (unsigned column = 0; column < width; column++) {
+            if (column > 0)
+                out += ',';
+            if (entry < path.blockEnds[b] && path.columns[entry] == column)
+                appendUnsigned(out, path.counts[entry++]);
+            else
+                out += '0';
+        }
+        out += '\n';
+    }
+    out += '\n';
+}
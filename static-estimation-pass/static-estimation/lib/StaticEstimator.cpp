@@ -19,33 +19,95 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 #include <fstream>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "AsyncWriter.h"
 #include "BLInstrumentation.h"
+#include "BlockFeatures.h"
+#include "FeatureBatch.h"
 #include "FeatureExtractor.h"
+#include "FeatureFile.h"
+#include "NumberFormat.h"
+#include "PathEnumerator.h"
+#include "PathCounts.h"
+#include "ParallelRunner.h"
+#include "PathRegions.h"
+
+#define PATH_BATCH 1024
 
 using namespace llvm;
 
+enum OutputFormat {
+  FormatCSV,
+  FormatBinary
+};
+
+static cl::opt<unsigned> NumThreads("static-estimation-threads",
+    cl::desc("Number of threads extracting features (0 = one per core)"),
+    cl::init(1));
+
+static cl::opt<unsigned> ChunkSize("static-estimation-chunk",
+    cl::desc("Paths per parallel task; larger functions are split"),
+    cl::init(4096));
+
+static cl::opt<bool> Regions("static-estimation-regions",
+    cl::desc("Extract the paths of single entry, single exit regions "
+             "instead of whole function paths"),
+    cl::init(false));
+
+static cl::opt<unsigned> RegionPaths("static-estimation-region-paths",
+    cl::desc("Merge neighbouring regions up to this many paths"),
+    cl::init(4096));
+
+static cl::opt<OutputFormat> Format("static-estimation-format",
+    cl::desc("Format of the feature output"),
+    cl::init(FormatCSV),
+    cl::values(
+      clEnumValN(FormatCSV, "csv", "Text rows in feature_output.csv"),
+      clEnumValN(FormatBinary, "binary",
+                 "Little endian columns in feature_output.bin"),
+      clEnumValEnd));
+
 class StaticEstimatorPass : public ModulePass {
 private:
   // Profiling
   PathProfileInfo* PI;
 
-  // File for output
-  std::ofstream ofs;
+  // File for output, written by a background thread
+  AsyncOutputFile ofs;
 
   // Instruments each function with path profiling.  'main' is instrumented
   // with code to save the profile to disk.
   bool runOnModule(Module &M);
 
-  // Calculate the path for a single ID
-  std::vector<BasicBlock*> computePath(BLInstrumentationDag* dag, unsigned pathNo);
-
-  // Calculates all paths for a dag
-  void calculatePaths(BLInstrumentationDag* dag);
-
-  // Analyzes the function for Ball-Larus path profiling, and inserts code.
-  void runOnFunction(std::vector<Constant*> &ftInit, Function &F, Module &M);
+  // Calculates the paths numbered [first, last) of a dag, a function or a
+  // region called name, whose blocks are counted in table. Safe to call
+  // from several threads at once.
+  void calculatePaths(const FlatPathDag& dag, const PathCounts& counts,
+                      const BlockFeatureTable& table,
+                      const std::string& name, PathID first, PathID last,
+                      std::ostream& out, raw_ostream& log);
+
+  // Writes the paths numbered [first, last) of a dag to rows firstRow on
+  // of a binary feature file, as unit unit. Safe to call from several
+  // threads at once.
+  void writePaths(const FlatPathDag& dag, const PathCounts& counts,
+                  const BlockFeatureTable& table, unsigned unit,
+                  PathID first, PathID last, uint64_t firstRow,
+                  FeatureFileWriter& file, raw_ostream& log);
+
+  // Extracts features for all paths of F.
+  void runOnFunction(Function &F, const PathCounts& counts,
+                     std::ostream& out, raw_ostream& log);
+
+  // Extracts features for all functions on nThreads threads. Functions
+  // are split into ranges of paths so that one huge function does not
+  // end up on a single thread. The binary format always goes this way,
+  // since its row count has to be known up front.
+  void runParallel(const std::vector<Function*>& functions,
+                   const std::vector<PathCounts>& counts, unsigned nThreads);
 
   // To use profiling info
   void getAnalysisUsage(AnalysisUsage &AU) const;
@@ -62,86 +124,258 @@ public:
   }
 };
 
-// Compute the path through the DAG from its path number
-std::vector<BasicBlock*> StaticEstimatorPass::computePath(BLInstrumentationDag* dag, unsigned pathNo) {
-    unsigned R = pathNo;
-    std::vector<BasicBlock*> path;
-
-    BLInstrumentationNode* curNode = (BLInstrumentationNode*)(dag->getRoot());
-    while (1) {
-        BLInstrumentationEdge* nextEdge;
-        unsigned bestEdge = 0;
-        // Add the basic block to the list
-        path.push_back(curNode->getBlock());
-        for (BLEdgeIterator next = curNode->succBegin(), end = curNode->succEnd(); next != end; next++) {
-            // We want the largest edge that's less than R
-            BLInstrumentationEdge* i = (BLInstrumentationEdge*) *next;
-            unsigned weight = i->getWeight();
-            if (weight <= R && weight >= bestEdge) {
-                bestEdge = weight;
-                nextEdge = i;
-            }
-        }
-        BLInstrumentationNode* nextNode = (BLInstrumentationNode*)(nextEdge->getTarget());
-        // Terminate on the <null> 
-        if (!nextNode->getBlock())
-            break;
-        // Move to next node
-        curNode = nextNode;
-        R -= bestEdge;
+// Iterate through the paths [first, last) of the dag
+void StaticEstimatorPass::calculatePaths(const FlatPathDag& dag,
+                                         const PathCounts& counts,
+                                         const BlockFeatureTable& table,
+                                         const std::string& name,
+                                         PathID first, PathID last,
+                                         std::ostream& out, raw_ostream& log) {
+  PathID nPaths = dag.getNumberOfPaths();
+
+  // Features are extracted a batch of paths at a time, then written out
+  std::vector<float> matrix(PATH_BATCH * NUM_FEATURES);
+  std::vector<PathID> ids(PATH_BATCH);
+  FeatureBatch batch(table);
+  batch.setMatrix(RowMajor, &matrix[0], NUM_FEATURES);
+
+  // A batch of rows is formatted into lines and written at once
+  PathEnumerator paths(dag, first, last);
+  std::string lines;
+  while (unsigned nRows = batch.fill(paths, PATH_BATCH, &ids[0])) {
+    lines.clear();
+    for (unsigned row = 0; row < nRows; row++) {
+      PathID i = ids[row];
+      // Show progress for large values
+      if (i % 10000 == 0 && i != 0)
+          log << "Computed for " << i << "/" << nPaths << " paths\n";
+
+      PathCounts::const_iterator curPath = counts.find(i);
+      unsigned n_real_count = 0;
+      if (curPath != counts.end()) {
+          n_real_count = curPath->second;
+      }
+
+      lines += name;
+      lines += '.';
+      appendUnsigned(lines, i);
+      lines += ", ";
+      appendUnsigned(lines, n_real_count);
+      lines += ',';
+      FeatureExtractor::appendCSV(lines, &matrix[row * NUM_FEATURES]);
     }
-    return path;
+    out.write(lines.data(), lines.size());
+  }
 }
 
-// Iterate through all possible paths in the dag
-void StaticEstimatorPass::calculatePaths(BLInstrumentationDag* dag) {
-  unsigned nPaths = dag->getNumberOfPaths();
-  errs() << "There are " << nPaths << " paths\n";
+// Same paths as calculatePaths, a batch of feature columns at a time
+void StaticEstimatorPass::writePaths(const FlatPathDag& dag,
+                                     const PathCounts& counts,
+                                     const BlockFeatureTable& table,
+                                     unsigned unit, PathID first, PathID last,
+                                     uint64_t firstRow,
+                                     FeatureFileWriter& file, raw_ostream& log) {
+  PathID nPaths = dag.getNumberOfPaths();
+
+  std::vector<float> matrix(PATH_BATCH * NUM_FEATURES);
+  std::vector<PathID> ids(PATH_BATCH);
+  std::vector<unsigned> realCounts(PATH_BATCH);
+  FeatureBatch batch(table);
+  batch.setMatrix(ColumnMajor, &matrix[0], PATH_BATCH);
+
+  PathEnumerator paths(dag, first, last);
+  uint64_t row = firstRow;
+  while (unsigned nRows = batch.fill(paths, PATH_BATCH, &ids[0])) {
+    for (unsigned r = 0; r < nRows; r++) {
+      PathID i = ids[r];
+      if (i % 10000 == 0 && i != 0)
+          log << "Computed for " << i << "/" << nPaths << " paths\n";
+
+      PathCounts::const_iterator curPath = counts.find(i);
+      realCounts[r] = curPath != counts.end() ? curPath->second : 0;
+    }
+    file.writeRows(row, nRows, unit, &ids[0], &realCounts[0],
+                   &matrix[0], PATH_BATCH);
+    row += nRows;
+  }
+}
 
-  Function* fn = dag->getRoot()->getBlock()->getParent();
-  PI->setCurrentFunction(fn);
-  unsigned nPathsRun = PI->pathsRun();
-  if (nPathsRun == 0) {
-      errs() << "This function is never run in profiling! Skipping...\n";
+// Entry point of the module
+void StaticEstimatorPass::runOnFunction(Function &F, const PathCounts& counts,
+                                        std::ostream& out, raw_ostream& log) {
+  log << "Running on function " << F.getName() << "\n";
+
+  std::unique_ptr<FlatPathDag> dag(buildFlatPathDag(F));
+  PathID nPaths = dag->getNumberOfPaths();
+  log << "There are " << nPaths << " paths\n";
+  if (dag->hasOverflow())
+      log << "WARNING: 2^64 paths or more, no path can be numbered!\n";
+
+  if (counts.empty()) {
+      log << "This function is never run in profiling! Skipping...\n";
+      return;
   }
-  else {
-      // Enumerate all paths in this function
-      for (int i=0; i<nPaths; i++) {
-          // Show progress for large values
-          if (i % 10000 == 0 && i != 0)
-              errs() << "Computed for " << i << "/" << nPaths << " paths\n";
-
-          std::vector<BasicBlock*> path = computePath(dag, i);
-          ProfilePath* curPath = PI->getPath(i);
-          unsigned n_real_count = 0;
-          if (curPath) {
-              n_real_count = curPath->getCount();
-          }
-
-          // Extract features 
-          FeatureExtractor* features = new FeatureExtractor(path);
-          features->extractFeatures();
-          std::string fnName = fn->getName();
-          ofs << fnName << "." << i << ", " << n_real_count << "," << features->getFeaturesCSV();
-          delete features;
+  // Regions are numbered on their own, so they are still extracted, but
+  // without counts
+  bool profiled = hasProfiledNumbers(*dag);
+  if (!profiled && !Regions) {
+      log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Skipping...\n";
+      return;
+  }
+
+  // Every block is counted once, whichever paths it is on
+  BlockFeatureTable table(F);
+
+  if (Regions) {
+      PathRegions regions(*dag, RegionPaths);
+      std::vector<PathCounts> regionCounts(regions.getNumberOfRegions());
+      if (profiled)
+          regionCounts = regions.getRegionCounts(counts);
+      else
+          log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Region paths are unlabelled\n";
+      log << "Split into " << regions.getNumberOfRegions() << " regions with "
+          << regions.getNumberOfPaths() << " paths\n";
+
+      for (unsigned r = 0; r < regions.getNumberOfRegions(); r++) {
+          const FlatPathDag& region = regions.getRegion(r);
+          calculatePaths(region, regionCounts[r], table,
+                         getRegionName(F.getName(), r),
+                         0, region.getNumberOfPaths(), out, log);
       }
+      return;
   }
+
+  // Calculate the features for each path 
+  calculatePaths(*dag, counts, table, F.getName(), 0, nPaths, out, log);
 }
 
-// Entry point of the module
-void StaticEstimatorPass::runOnFunction(std::vector<Constant*> &ftInit,
-                                 Function &F, Module &M) {
-  errs() << "Running on function " << F.getName() << "\n";
+void StaticEstimatorPass::runParallel(const std::vector<Function*>& functions,
+                                      const std::vector<PathCounts>& counts,
+                                      unsigned nThreads) {
+  // Number every function first, so the work can be split by path count
+  std::vector<std::unique_ptr<FlatPathDag>> dags(functions.size());
+  std::vector<std::unique_ptr<PathRegions>> regions(functions.size());
+  std::vector<std::vector<PathCounts> > regionCounts(functions.size());
+  std::vector<std::unique_ptr<BlockFeatureTable>> tables(functions.size());
+  // Profiled, and either with path IDs that match the profile or split
+  // into regions
+  std::vector<char> used(functions.size(), 0);
+  runOrdered(nThreads, functions.size(),
+             [&](unsigned i, std::ostream& /*out*/, raw_ostream& log) {
+               log << "Running on function " << functions[i]->getName() << "\n";
+               dags[i].reset(buildFlatPathDag(*functions[i]));
+               log << "There are " << dags[i]->getNumberOfPaths() << " paths\n";
+               if (dags[i]->hasOverflow())
+                 log << "WARNING: 2^64 paths or more, no path can be numbered!\n";
+
+               if (counts[i].empty()) {
+                 log << "This function is never run in profiling! Skipping...\n";
+                 dags[i].reset();
+                 return;
+               }
+               bool profiled = hasProfiledNumbers(*dags[i]);
+               if (!profiled && !Regions) {
+                 log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Skipping...\n";
+                 dags[i].reset();
+                 return;
+               }
+               used[i] = 1;
+
+               tables[i].reset(new BlockFeatureTable(*functions[i]));
+               if (Regions) {
+                 regions[i].reset(new PathRegions(*dags[i], RegionPaths));
+                 regionCounts[i].resize(regions[i]->getNumberOfRegions());
+                 if (profiled)
+                   regionCounts[i] = regions[i]->getRegionCounts(counts[i]);
+                 else
+                   log << "WARNING: more than 2^32 paths, profiled path IDs wrap around! Region paths are unlabelled\n";
+                 log << "Split into " << regions[i]->getNumberOfRegions()
+                     << " regions with " << regions[i]->getNumberOfPaths()
+                     << " paths\n";
+               }
+             }, ofs);
+
+  // The dags to extract, in output order: whole functions or their regions
+  std::vector<const FlatPathDag*> units;
+  std::vector<const PathCounts*> unitCounts;
+  std::vector<const BlockFeatureTable*> unitTables;
+  std::vector<std::string> unitNames;
+  std::vector<unsigned> unitFunction;
+  std::vector<PathID> nPaths;
+  for (unsigned i = 0; i < functions.size(); i++) {
+    if (!used[i])
+      continue;
+
+    if (!Regions) {
+      units.push_back(dags[i].get());
+      unitCounts.push_back(&counts[i]);
+      unitTables.push_back(tables[i].get());
+      unitNames.push_back(functions[i]->getName());
+      unitFunction.push_back(i);
+      nPaths.push_back(dags[i]->getNumberOfPaths());
+      continue;
+    }
+    for (unsigned r = 0; r < regions[i]->getNumberOfRegions(); r++) {
+      units.push_back(&regions[i]->getRegion(r));
+      unitCounts.push_back(&regionCounts[i][r]);
+      unitTables.push_back(tables[i].get());
+      unitNames.push_back(getRegionName(functions[i]->getName(), r));
+      unitFunction.push_back(i);
+      nPaths.push_back(units.back()->getNumberOfPaths());
+    }
+  }
 
-  // Build DAG from CFG
-  BLInstrumentationDag dag = BLInstrumentationDag(F);
-  dag.init();
+  // Functions are freed once their last range is flushed. Ranges are
+  // flushed in order, so every function before that one is done too.
+  unsigned released = 0;
+  auto release = [&](unsigned end) {
+    for (; released < end; released++) {
+      dags[released].reset();
+      regions[released].reset();
+      tables[released].reset();
+      std::vector<PathCounts>().swap(regionCounts[released]);
+    }
+  };
+
+  PathRanges ranges(nPaths, ChunkSize);
+  errs() << "Extracting " << ranges.size() << " ranges of paths\n";
+
+  std::unique_ptr<FeatureFileWriter> file;
+  std::vector<uint64_t> firstRows(units.size());
+  if (Format == FormatBinary) {
+    uint64_t nRows = 0;
+    for (unsigned u = 0; u < units.size(); u++) {
+      firstRows[u] = nRows;
+      nRows += nPaths[u];
+    }
+    errs() << "Writing " << nRows << " rows\n";
+    file.reset(new FeatureFileWriter("feature_output.bin", unitNames, nRows));
+  }
 
-  // give each path a unique integer value
-  dag.calculatePathNumbers();
- 
-  // Calculate the features for each path 
-  calculatePaths(&dag);
+  runOrdered(nThreads, ranges.size(),
+             [&](unsigned t, std::ostream& out, raw_ostream& log) {
+               PathRange r = ranges[t];
+               if (file) {
+                 writePaths(*units[r.function], *unitCounts[r.function],
+                            *unitTables[r.function], r.function,
+                            r.first, r.last, firstRows[r.function] + r.first,
+                            *file, log);
+                 return;
+               }
+               calculatePaths(*units[r.function], *unitCounts[r.function],
+                              *unitTables[r.function], unitNames[r.function],
+                              r.first, r.last, out, log);
+             }, ofs,
+             [&](unsigned t) {
+               unsigned u = ranges[t].function;
+               unsigned f = unitFunction[u];
+               bool lastRange = ranges[t].last == nPaths[u];
+               bool lastUnit = u + 1 == units.size() || unitFunction[u + 1] != f;
+               release(lastRange && lastUnit ? f + 1 : f);
+             });
+
+  if (file && !file->good())
+    errs() << "WARNING: could not write feature_output.bin!\n";
 }
 
 bool StaticEstimatorPass::runOnModule(Module &M) {
@@ -149,10 +383,12 @@ bool StaticEstimatorPass::runOnModule(Module &M) {
 
   PI = &getAnalysis<PathProfileInfo>();
 
-  // Start outputs
-  std::string fname = "feature_output.csv";
+  // Start outputs. The binary file is only created once its rows are known.
+  bool binary = Format == FormatBinary;
+  std::string fname = binary ? "feature_output.bin" : "feature_output.csv";
   errs() << "Writing to " << fname << "\n";
-  ofs.open(fname, std::ofstream::out);
+  if (!binary)
+    ofs.open(fname, std::ofstream::out);
 
   // No main, no instrumentation!
   Function *Main = M.getFunction("main");
@@ -165,21 +401,30 @@ bool StaticEstimatorPass::runOnModule(Module &M) {
     return false;
   }
 
-  // Run some dummy feature extraction to get the col names
-  std::vector<BasicBlock*> tempPath;
-  tempPath.push_back(&Main->getEntryBlock());
-  FeatureExtractor* features = new FeatureExtractor(tempPath);
-  features->extractFeatures();
-  ofs << "ID,RealCount," << features->getFeaturesCSVNames();
+  // The columns are fixed, no path is needed to name them
+  if (!binary)
+    ofs << "ID,RealCount," << FeatureExtractor::getFeaturesCSVNames();
 
 
-  std::vector<Constant*> ftInit;
-  unsigned functionNumber = 0;
+  // Profile counts are read up front; PathProfileInfo is not thread safe
+  std::vector<Function*> functions;
+  std::vector<PathCounts> counts;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
     if (F->isDeclaration())
       continue;
 
-    runOnFunction(ftInit, *F, M);
+    functions.push_back(&*F);
+    counts.push_back(getPathCounts(PI, &*F));
+  }
+
+  unsigned nThreads = getWorkerCount(NumThreads);
+  if (nThreads <= 1 && !binary) {
+    for (unsigned i = 0; i < functions.size(); i++)
+      runOnFunction(*functions[i], counts[i], ofs, errs());
+  }
+  else {
+    errs() << "Extracting with " << nThreads << " threads\n";
+    runParallel(functions, counts, nThreads);
   }
 
   ofs.close();
@@ -0,0 +1,82 @@
+// Converts a sparse LSTM feature file (-lstm-format=sparse) back to the text
+// format of -lstm-format=paths, for tools that only read text.
+//
+//   LSTMDecode feature_output.lstm [feature_output.csv]
+//
+// Without an output file the text goes to standard output.
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "SparseLSTM.h"
+
+// Text is written out in pieces of about this many bytes
+#define OUTPUT_CHUNK (1 << 20)
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "usage: " << argv[0] << " input.lstm [output.csv]\n";
+    return 1;
+  }
+
+  std::ifstream in(argv[1], std::ifstream::in | std::ifstream::binary);
+  if (!in) {
+    std::cerr << "cannot open " << argv[1] << "\n";
+    return 1;
+  }
+  std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+  SparseLSTMReader reader(data.empty() ? NULL : &data[0], data.size());
+  if (!reader.good()) {
+    std::cerr << argv[1] << " is not a sparse LSTM feature file\n";
+    return 1;
+  }
+
+  std::ofstream file;
+  if (argc == 3) {
+    file.open(argv[2], std::ofstream::out);
+    if (!file) {
+      std::cerr << "cannot open " << argv[2] << "\n";
+      return 1;
+    }
+  }
+  std::ostream& out = argc == 3 ? file : std::cout;
+
+  const std::vector<unsigned>& opcodes = reader.getOpcodes();
+  std::string text = "# opcodes ";
+  for (unsigned i = 0; i < opcodes.size(); i++) {
+    if (i > 0)
+      text += ',';
+    text += std::to_string(opcodes[i]);
+  }
+  text += '\n';
+
+  SparsePath path;
+  unsigned long nPaths = 0;
+  while (reader.next(path)) {
+    appendDensePath(text, path, opcodes.size());
+    nPaths++;
+    if (text.size() >= OUTPUT_CHUNK) {
+      out.write(text.data(), text.size());
+      text.clear();
+    }
+  }
+  out.write(text.data(), text.size());
+  out.flush();
+
+  if (!reader.good()) {
+    std::cerr << argv[1] << " is cut short or corrupt after " << nPaths
+              << " paths\n";
+    return 1;
+  }
+  if (!out) {
+    std::cerr << "could not write the output\n";
+    return 1;
+  }
+  std::cerr << "Decoded " << nPaths << " paths\n";
+  return 0;
+}
@@ -0,0 +1,32 @@
+// Converts the static_predictions.csv written by the classification
+// scripts into a binary prediction file, which LSTMProfileSpooferPass maps
+// instead of parsing.
+//
+//   PredictionConvert static_predictions.csv static_predictions.bin
+#include <iostream>
+#include <string>
+
+#include "PathPredictions.h"
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " predictions.csv predictions.bin\n";
+    return 1;
+  }
+
+  PathPredictions predictions;
+  std::string error;
+  if (!predictions.load(argv[1], error)) {
+    std::cerr << argv[1] << ": " << error << "\n";
+    return 1;
+  }
+  if (!predictions.writeBinary(argv[2])) {
+    std::cerr << "could not write " << argv[2] << "\n";
+    return 1;
+  }
+
+  std::cerr << "Wrote " << predictions.getNumberOfPredictions()
+            << " predictions for " << predictions.getNumberOfFunctions()
+            << " functions\n";
+  return 0;
+}